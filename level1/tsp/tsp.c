@@ -4,7 +4,13 @@
 #include <math.h>
 #include <string.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+#include <stdatomic.h>
+#include <pthread.h>
 #include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
 
 float distance(float a[2], float b[2])
 {
@@ -16,41 +22,219 @@ void swap(int *a, int *b)
     int temp = *a; *a = *b; *b = temp;
 }
 
-float path_dist(float (*array)[2], int *path, ssize_t size)
+// Brute force up to TSP_BRUTE_MAX cities, Held-Karp up to TSP_DP_MAX
+#define TSP_BRUTE_MAX 8
+#define TSP_DP_MAX 20
+
+typedef struct s_stats
 {
-    float dist = 0.0;
-    for (ssize_t i = 0; i < size; i++)
-        dist += distance(array[path[i]], array[path[(i + 1) % size]]);
-    return dist;
+    unsigned long nodes_expanded;
+    unsigned long nodes_pruned;
+    unsigned long dp_states;
+    unsigned long distance_evals;
+    long load_ns, matrix_ns, search_ns;
+} t_stats;
+
+/*
+ * Scratch buffers for one solver. They only ever grow, so a workspace
+ * reused across instances stops allocating once it has seen the largest.
+ */
+typedef struct s_workspace
+{
+    int *path;
+    float *dist;    // size * size distance matrix
+    float *dp;      // Held-Karp table, (1 << (size - 1)) * (size - 1) entries
+    ssize_t cap;
+    size_t dp_cap;
+    int *tour;      // caller's output for the best tour, NULL if unwanted
+    t_stats stats;  // counters of the last solve
+} t_workspace;
+
+long now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000L + ts.tv_nsec;
 }
 
-void permute(float (*array)[2], int *path, ssize_t size, int start, float *best)
+void workspace_free(t_workspace *ws)
 {
+    free(ws->path); free(ws->dist); free(ws->dp);
+    *ws = (t_workspace){0};
+}
+
+int workspace_reserve(t_workspace *ws, ssize_t size)
+{
+    if (size > ws->cap)
+    {
+        int *path = realloc(ws->path, size * sizeof(int));
+        if (!path) return -1;
+        ws->path = path;
+        float *dist = realloc(ws->dist, size * size * sizeof(float));
+        if (!dist) return -1;
+        ws->dist = dist;
+        ws->cap = size;
+    }
+    if (size > TSP_BRUTE_MAX && size <= TSP_DP_MAX)
+    {
+        size_t need = ((size_t)1 << (size - 1)) * (size - 1);
+        if (need > ws->dp_cap)
+        {
+            float *dp = realloc(ws->dp, need * sizeof(float));
+            if (!dp) return -1;
+            ws->dp = dp;
+            ws->dp_cap = need;
+        }
+    }
+    return 0;
+}
+
+// Branches whose partial length already reaches `best` are cut
+void permute(t_workspace *ws, ssize_t size, int start, float partial, float *best)
+{
+    int *path = ws->path;
+    float *dist = ws->dist;
+    ws->stats.nodes_expanded++;
     if (start == size)
     {
-        float curr = path_dist(array, path, size);
-        if (curr < *best) *best = curr;
+        float curr = partial + dist[path[size - 1] * size + path[0]];
+        if (curr < *best)
+        {
+            *best = curr;
+            if (ws->tour) memcpy(ws->tour, path, size * sizeof(int));
+        }
         return;
     }
     for (int i = start; i < size; i++)
     {
         swap(&path[start], &path[i]);
-        permute(array, path, size, start + 1, best);
+        float next = partial + dist[path[start - 1] * size + path[start]];
+        if (next < *best) permute(ws, size, start + 1, next, best);
+        else ws->stats.nodes_pruned++;
         swap(&path[start], &path[i]);
     }
 }
 
-float tsp(float (*array)[2], ssize_t size)
+// Walks the table back from the last city, taking the cheapest predecessor each step
+// so that a valid one is found even when float rounding breaks exact equality
+void held_karp_tour(t_workspace *ws, ssize_t size, ssize_t last)
 {
-    if (size <= 1) return 0.0;
-    int *path = malloc(size * sizeof(int));
-    for (int i = 0; i < size; i++) path[i] = i;
+    ssize_t n = size - 1;
+    size_t mask = ((size_t)1 << n) - 1;
+    ws->tour[0] = 0;
+    for (ssize_t pos = n; pos > 0; pos--)
+    {
+        ws->tour[pos] = last + 1;
+        size_t prev = mask & ~((size_t)1 << last);
+        if (!prev) break;
+        ssize_t from = -1;
+        float best = 0;
+        for (ssize_t k = 0; k < n; k++)
+        {
+            if (!(prev & ((size_t)1 << k))) continue;
+            float len = ws->dp[prev * n + k] + ws->dist[(k + 1) * size + last + 1];
+            if (from == -1 || len < best) { best = len; from = k; }
+        }
+        mask = prev;
+        last = from;
+    }
+}
+
+// dp[mask * n + j]: shortest path from city 0 through `mask` ending at city j + 1
+float held_karp(t_workspace *ws, ssize_t size)
+{
+    float *dist = ws->dist, *dp = ws->dp;
+    ssize_t n = size - 1;
+    size_t full = (size_t)1 << n;
+    for (size_t mask = 1; mask < full; mask++)
+        for (ssize_t j = 0; j < n; j++)
+        {
+            if (!(mask & ((size_t)1 << j))) continue;
+            size_t prev = mask & ~((size_t)1 << j);
+            float best = prev ? __FLT_MAX__ : dist[j + 1];
+            for (ssize_t k = 0; prev && k < n; k++)
+                if (prev & ((size_t)1 << k))
+                {
+                    float curr = dp[prev * n + k] + dist[(k + 1) * size + j + 1];
+                    if (curr < best) best = curr;
+                }
+            dp[mask * n + j] = best;
+            ws->stats.dp_states++;
+        }
     float best = __FLT_MAX__;
-    permute(array, path, size, 1, &best);
-    free(path);
+    ssize_t last = 0;
+    for (ssize_t j = 0; j < n; j++)
+    {
+        float curr = dp[(full - 1) * n + j] + dist[(j + 1) * size];
+        if (curr < best) { best = curr; last = j; }
+    }
+    if (ws->tour) held_karp_tour(ws, size, last);
     return best;
 }
 
+bool use_held_karp(ssize_t size)
+{
+    return size > TSP_BRUTE_MAX && size <= TSP_DP_MAX;
+}
+
+float tsp_solve(t_workspace *ws, float (*array)[2], ssize_t size, int *tour)
+{
+    ws->stats = (t_stats){0};
+    ws->tour = tour;
+    if (size <= 1) { if (tour && size) tour[0] = 0; return 0.0; }
+    if (workspace_reserve(ws, size) == -1) return -1.0;
+    long start = now_ns();
+    for (ssize_t i = 0; i < size; i++)
+    {
+        ws->dist[i * size + i] = 0.0;
+        for (ssize_t j = i + 1; j < size; j++)
+            ws->dist[i * size + j] = ws->dist[j * size + i] = distance(array[i], array[j]);
+    }
+    ws->stats.distance_evals = size * (size - 1) / 2;
+    long built = now_ns();
+    ws->stats.matrix_ns = built - start;
+    float best = __FLT_MAX__;
+    if (use_held_karp(size))
+        best = held_karp(ws, size);
+    else
+    {
+        for (int i = 0; i < size; i++) ws->path[i] = i;
+        permute(ws, size, 1, 0.0, &best);
+    }
+    ws->stats.search_ns = now_ns() - built;
+    return best;
+}
+
+// `tour`, when not NULL, receives the `size` city indices of a shortest tour
+float tsp_tour(float (*array)[2], ssize_t size, int *tour)
+{
+    t_workspace ws = {0};
+    float best = tsp_solve(&ws, array, size, tour);
+    workspace_free(&ws);
+    return best;
+}
+
+float tsp(float (*array)[2], ssize_t size)
+{
+    return tsp_tour(array, size, NULL);
+}
+
+void print_result(FILE *out, float best, int *tour, ssize_t size)
+{
+    fprintf(out, "%.2f", best);
+    for (ssize_t i = 0; tour && i < size; i++)
+        fprintf(out, " %d", tour[i]);
+    fprintf(out, "\n");
+}
+
+void print_stats(FILE *out, t_stats *s, ssize_t size)
+{
+    fprintf(out, "{\"cities\":%zd,\"engine\":\"%s\",\"nodes_expanded\":%lu,\"nodes_pruned\":%lu,"
+        "\"dp_states\":%lu,\"distance_evals\":%lu,\"load_ns\":%ld,\"matrix_ns\":%ld,\"search_ns\":%ld}\n",
+        size, use_held_karp(size) ? "held_karp" : "brute_force", s->nodes_expanded, s->nodes_pruned,
+        s->dp_states, s->distance_evals, s->load_ns, s->matrix_ns, s->search_ns);
+}
+
 ssize_t file_size(FILE *file)
 {
     char *buffer = NULL;
@@ -73,48 +257,362 @@ int retrieve_file(float (*array)[2], FILE *file)
     return 0;
 }
 
-int main(int ac, char **av)
+/*
+ * Binary city file: header followed by `count` packed x/y pairs of
+ * `precision` bytes each (4 = float32, 8 = float64), native endianness.
+ * float32 files are mapped straight into the float (*)[2] view.
+ */
+#define TSPB_MAGIC "TSPB"
+
+struct tspb_header
 {
-    char *filename = "stdin";
-    FILE *file = stdin;
-    if (ac > 1) { filename = av[1]; file = fopen(filename, "r"); }
-    if (!file) { fprintf(stderr, "Error opening %s\n", filename); return 1; }
-    
-    if (file == stdin)
-    {
-        // For stdin, read dynamically
-        float (*array)[2] = NULL;
-        size_t capacity = 0, size = 0;
-        float x, y;
-        
-        while (fscanf(file, "%f, %f", &x, &y) == 2)
+    char magic[4];
+    uint32_t precision;
+    uint64_t count;
+};
+
+typedef struct s_cities
+{
+    float (*array)[2];
+    ssize_t size;
+    void *map;
+    size_t map_len;
+} t_cities;
+
+void release_cities(t_cities *c)
+{
+    if (c->map) munmap(c->map, c->map_len);
+    else free(c->array);
+    c->array = NULL; c->map = NULL;
+}
+
+int read_stream(FILE *file, t_cities *c)
+{
+    float (*array)[2] = NULL;
+    size_t capacity = 0, size = 0;
+    float x, y;
+    while (fscanf(file, "%f, %f", &x, &y) == 2)
+    {
+        if (size >= capacity)
         {
-            if (size >= capacity)
+            capacity = capacity ? capacity * 2 : 8;
+            float (*new_array)[2] = realloc(array, capacity * sizeof(float[2]));
+            if (!new_array) { free(array); return -1; }
+            array = new_array;
+        }
+        array[size][0] = x;
+        array[size][1] = y;
+        size++;
+    }
+    if (size == 0) { free(array); errno = EINVAL; return -1; }
+    c->array = array; c->size = size; c->map = NULL;
+    return 0;
+}
+
+int read_text(FILE *file, t_cities *c)
+{
+    if (file == stdin) return read_stream(file, c);
+    ssize_t size = file_size(file);
+    if (size <= 0) return -1;
+    float (*array)[2] = calloc(size, sizeof(float[2]));
+    if (!array) return -1;
+    if (retrieve_file(array, file) == -1) { free(array); return -1; }
+    c->array = array; c->size = size; c->map = NULL;
+    return 0;
+}
+
+bool is_binary(FILE *file)
+{
+    char magic[4];
+    bool ret = fread(magic, 1, 4, file) == 4 && !memcmp(magic, TSPB_MAGIC, 4);
+    if (fseek(file, 0, SEEK_SET)) return false;
+    return ret;
+}
+
+int load_binary(FILE *file, t_cities *c)
+{
+    struct stat st;
+    int fd = fileno(file);
+    if (fstat(fd, &st) == -1) return -1;
+    if ((size_t)st.st_size < sizeof(struct tspb_header)) { errno = EINVAL; return -1; }
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED) return -1;
+    struct tspb_header *hdr = map;
+    size_t elem = hdr->precision;
+    if ((elem != sizeof(float) && elem != sizeof(double)) || hdr->count == 0
+        || hdr->count > (st.st_size - sizeof(*hdr)) / (2 * elem))
+    {
+        munmap(map, st.st_size);
+        errno = EINVAL;
+        return -1;
+    }
+    c->size = hdr->count;
+    if (elem == sizeof(float))
+    {
+        c->array = (float (*)[2])(hdr + 1);
+        c->map = map; c->map_len = st.st_size;
+        return 0;
+    }
+    // float64 has to be narrowed, so it is the one case that copies
+    double (*src)[2] = (double (*)[2])(hdr + 1);
+    c->array = calloc(c->size, sizeof(float[2]));
+    if (c->array)
+        for (ssize_t i = 0; i < c->size; i++)
+        {
+            c->array[i][0] = src[i][0];
+            c->array[i][1] = src[i][1];
+        }
+    munmap(map, st.st_size);
+    c->map = NULL;
+    return c->array ? 0 : -1;
+}
+
+int write_binary(FILE *out, t_cities *c, uint32_t precision)
+{
+    struct tspb_header hdr = {.precision = precision, .count = c->size};
+    memcpy(hdr.magic, TSPB_MAGIC, 4);
+    if (fwrite(&hdr, sizeof(hdr), 1, out) != 1) return -1;
+    if (precision == sizeof(float))
+        return fwrite(c->array, sizeof(float[2]), c->size, out) == (size_t)c->size ? 0 : -1;
+    for (ssize_t i = 0; i < c->size; i++)
+    {
+        double xy[2] = {c->array[i][0], c->array[i][1]};
+        if (fwrite(xy, sizeof(xy), 1, out) != 1) return -1;
+    }
+    return 0;
+}
+
+// tsp --convert <in.txt> <out.tspb> [f32|f64]
+int convert(int ac, char **av)
+{
+    if (ac < 2 || (ac > 2 && strcmp(av[2], "f32") && strcmp(av[2], "f64")))
+    {
+        fprintf(stderr, "Usage: tsp --convert <input> <output> [f32|f64]\n");
+        return 1;
+    }
+    uint32_t precision = ac > 2 && !strcmp(av[2], "f64") ? sizeof(double) : sizeof(float);
+    FILE *in = strcmp(av[0], "-") ? fopen(av[0], "r") : stdin;
+    if (!in) { fprintf(stderr, "Error opening %s\n", av[0]); return 1; }
+    t_cities c = {0};
+    int ret = read_text(in, &c);
+    if (in != stdin) fclose(in);
+    if (ret == -1) { fprintf(stderr, "Error reading %s\n", av[0]); return 1; }
+    FILE *out = fopen(av[1], "wb");
+    if (!out) { fprintf(stderr, "Error opening %s\n", av[1]); release_cities(&c); return 1; }
+    ret = write_binary(out, &c, precision);
+    if (fclose(out)) ret = -1;
+    release_cities(&c);
+    if (ret == -1) { fprintf(stderr, "Error writing %s\n", av[1]); return 1; }
+    return 0;
+}
+
+/*
+ * Batch mode: instances are separated by blank lines and one length is
+ * printed per instance, in input order. Instances are read CHUNK at a time
+ * and handed to `threads` workers, each keeping its own workspace.
+ */
+#define BATCH_CHUNK 1024
+
+typedef struct s_batch
+{
+    float (*coords)[2];     // cities of every instance in the chunk, back to back
+    size_t coords_len, coords_cap;
+    size_t *offset;         // instance i is coords[offset[i]..offset[i + 1])
+    float *result;          // NAN for a malformed instance
+    int *tours;             // laid out like coords, NULL unless --tour
+    t_stats *stats;         // NULL unless --stats
+    size_t count;
+    atomic_size_t next;
+} t_batch;
+
+typedef struct s_worker
+{
+    t_batch *batch;
+    t_workspace *ws;
+} t_worker;
+
+void *batch_worker(void *arg)
+{
+    t_worker *w = arg;
+    t_batch *b = w->batch;
+    for (size_t i; (i = atomic_fetch_add(&b->next, 1)) < b->count;)
+    {
+        if (isnan(b->result[i])) continue;
+        b->result[i] = tsp_solve(w->ws, b->coords + b->offset[i], b->offset[i + 1] - b->offset[i],
+            b->tours ? b->tours + b->offset[i] : NULL);
+        if (b->stats) b->stats[i] = w->ws->stats;
+    }
+    return NULL;
+}
+
+int batch_push(t_batch *b, float x, float y)
+{
+    if (b->coords_len == b->coords_cap)
+    {
+        size_t cap = b->coords_cap * 2;
+        float (*coords)[2] = realloc(b->coords, cap * sizeof(float[2]));
+        if (!coords) return -1;
+        b->coords = coords;
+        if (b->tours)
+        {
+            int *tours = realloc(b->tours, cap * sizeof(int));
+            if (!tours) return -1;
+            b->tours = tours;
+        }
+        b->coords_cap = cap;
+    }
+    b->coords[b->coords_len][0] = x;
+    b->coords[b->coords_len][1] = y;
+    b->coords_len++;
+    return 0;
+}
+
+bool is_blank(const char *line)
+{
+    while (*line == ' ' || *line == '\t' || *line == '\n' || *line == '\r') line++;
+    return !*line;
+}
+
+// Fills the next chunk; returns the number of instances read or -1
+ssize_t batch_read(t_batch *b, FILE *file, char **line, size_t *n)
+{
+    b->coords_len = 0;
+    b->count = 0;
+    b->offset[0] = 0;
+    bool open = false, bad = false;
+    float x, y;
+    while (b->count < BATCH_CHUNK)
+    {
+        ssize_t len = getline(line, n, file);
+        if (len == -1 || is_blank(*line))
+        {
+            if (open)
             {
-                capacity = capacity ? capacity * 2 : 8;
-                float (*new_array)[2] = realloc(array, capacity * sizeof(float[2]));
-                if (!new_array) { free(array); fprintf(stderr, "Error allocating memory\n"); return 1; }
-                array = new_array;
+                b->result[b->count] = bad ? NAN : 0.0;
+                b->offset[++b->count] = b->coords_len;
+                open = bad = false;
             }
-            array[size][0] = x;
-            array[size][1] = y;
-            size++;
+            if (len == -1) break;
+            continue;
         }
-        
-        if (size == 0) { free(array); fprintf(stderr, "Error reading %s\n", filename); return 1; }
-        fprintf(stdout, "%.2f\n", tsp(array, size));
-        free(array);
+        open = true;
+        if (sscanf(*line, "%f, %f", &x, &y) != 2) bad = true;
+        else if (batch_push(b, x, y) == -1) return -1;
     }
-    else
+    if (ferror(file)) return -1;
+    atomic_store(&b->next, 0);
+    return b->count;
+}
+
+typedef struct s_options
+{
+    bool tour;
+    bool stats;
+} t_options;
+
+// tsp [--tour] [--stats] --batch [-j threads] [file]
+int batch(int ac, char **av, t_options *opt)
+{
+    long threads = 1;
+    if (ac > 0 && !strcmp(av[0], "-j"))
     {
-        ssize_t size = file_size(file);
-        if (size <= 0) { fprintf(stderr, "Error reading %s\n", filename); fclose(file); return 1; }
-        float (*array)[2] = calloc(size, sizeof(float[2]));
-        if (!array) { fprintf(stderr, "Error allocating memory\n"); fclose(file); return 1; }
-        if (retrieve_file(array, file) == -1) { fprintf(stderr, "Error reading %s\n", filename); fclose(file); free(array); return 1; }
-        fclose(file);
-        fprintf(stdout, "%.2f\n", tsp(array, size));
-        free(array);
+        threads = ac > 1 ? strtol(av[1], NULL, 10) : 0;
+        ac -= ac > 1 ? 2 : 1; av += 2;
     }
+    if (threads < 1 || threads > 256 || ac > 1)
+    {
+        fprintf(stderr, "Usage: tsp --batch [-j threads] [file]\n");
+        return 1;
+    }
+    char *filename = ac ? av[0] : "stdin";
+    FILE *file = ac ? fopen(filename, "r") : stdin;
+    if (!file) { fprintf(stderr, "Error opening %s\n", filename); return 1; }
+
+    t_batch b = {0};
+    t_workspace *ws = calloc(threads, sizeof(t_workspace));
+    t_worker *workers = calloc(threads, sizeof(t_worker));
+    pthread_t *tids = calloc(threads, sizeof(pthread_t));
+    b.offset = malloc((BATCH_CHUNK + 1) * sizeof(size_t));
+    b.result = malloc(BATCH_CHUNK * sizeof(float));
+    b.coords_cap = 256;
+    b.coords = malloc(b.coords_cap * sizeof(float[2]));
+    b.tours = opt->tour ? malloc(b.coords_cap * sizeof(int)) : NULL;
+    b.stats = opt->stats ? malloc(BATCH_CHUNK * sizeof(t_stats)) : NULL;
+    char *line = NULL;
+    size_t n = 0;
+    int ret = ws && workers && tids && b.offset && b.result && b.coords
+        && (!opt->tour || b.tours) && (!opt->stats || b.stats) ? 0 : -1;
+    if (ret == -1) fprintf(stderr, "Error allocating memory\n");
+    for (long t = 0; ret == 0 && t < threads; t++)
+        workers[t] = (t_worker){.batch = &b, .ws = &ws[t]};
+
+    ssize_t count;
+    bool failed = false;
+    long start = now_ns();
+    while (ret == 0 && (count = batch_read(&b, file, &line, &n)) > 0)
+    {
+        long load_ns = (now_ns() - start) / count;
+        long spawned = 0;
+        for (; spawned + 1 < threads && spawned + 1 < count; spawned++)
+            if (pthread_create(&tids[spawned], NULL, batch_worker, &workers[spawned + 1]))
+                break;
+        batch_worker(&workers[0]);
+        for (long t = 0; t < spawned; t++)
+            pthread_join(tids[t], NULL);
+        for (ssize_t i = 0; i < count; i++)
+        {
+            ssize_t size = b.offset[i + 1] - b.offset[i];
+            if (isnan(b.result[i]) || b.result[i] < 0) { fprintf(stdout, "error\n"); failed = true; continue; }
+            print_result(stdout, b.result[i], b.tours ? b.tours + b.offset[i] : NULL, size);
+            if (!b.stats) continue;
+            // reading is per chunk, so each instance is charged an equal share
+            b.stats[i].load_ns = load_ns;
+            print_stats(stderr, &b.stats[i], size);
+        }
+        start = now_ns();
+    }
+    if (ret == 0 && count == -1) { fprintf(stderr, "Error reading %s\n", filename); ret = -1; }
+
+    for (long t = 0; ws && t < threads; t++) workspace_free(&ws[t]);
+    free(ws); free(workers); free(tids);
+    free(b.coords); free(b.offset); free(b.result); free(b.tours); free(b.stats); free(line);
+    if (file != stdin) fclose(file);
+    return ret == -1 || failed;
+}
+
+int main(int ac, char **av)
+{
+    if (ac > 1 && !strcmp(av[1], "--convert")) return convert(ac - 2, av + 2);
+    t_options opt = {0};
+    for (; ac > 1 && !strncmp(av[1], "--", 2); ac--, av++)
+    {
+        if (!strcmp(av[1], "--tour")) opt.tour = true;
+        else if (!strcmp(av[1], "--stats")) opt.stats = true;
+        else break;
+    }
+    if (ac > 1 && !strcmp(av[1], "--batch")) return batch(ac - 2, av + 2, &opt);
+
+    char *filename = "stdin";
+    FILE *file = stdin;
+    if (ac > 1) { filename = av[1]; file = fopen(filename, "r"); }
+    if (!file) { fprintf(stderr, "Error opening %s\n", filename); return 1; }
+
+    t_cities c = {0};
+    long start = now_ns();
+    int ret = file != stdin && is_binary(file) ? load_binary(file, &c) : read_text(file, &c);
+    if (file != stdin) fclose(file);
+    if (ret == -1) { fprintf(stderr, "Error reading %s\n", filename); return 1; }
+    long load_ns = now_ns() - start;
+
+    t_workspace ws = {0};
+    int *tour = opt.tour ? malloc(c.size * sizeof(int)) : NULL;
+    float best = opt.tour && !tour ? -1.0 : tsp_solve(&ws, c.array, c.size, tour);
+    release_cities(&c);
+    if (best < 0) { fprintf(stderr, "Error allocating memory\n"); workspace_free(&ws); free(tour); return 1; }
+    print_result(stdout, best, tour, c.size);
+    ws.stats.load_ns = load_ns;
+    if (opt.stats) print_stats(stderr, &ws.stats, c.size);
+    workspace_free(&ws);
+    free(tour);
     return 0;
-} 
\ No newline at end of file
+}
@@ -1,59 +1,409 @@
+#define _GNU_SOURCE
 #include <unistd.h>
 #include <sys/wait.h>
 #include <stdlib.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <spawn.h>
+#include <string.h>
+#include <pthread.h>
+#include <stdbool.h>
+
+extern char **environ;
+
+/*
+ * Starts file with stdin/stdout redirected to in/out (-1 keeps the parent's).
+ * posix_spawn runs on a vfork-style clone, so launch time does not grow with
+ * the parent's memory. Pipes are O_CLOEXEC: only the dup2'd copies survive.
+ */
+pid_t launch(const char *file, char *const argv[], int in, int out)
+{
+    posix_spawn_file_actions_t fa;
+    pid_t pid;
+    int err = posix_spawn_file_actions_init(&fa);
+    if (err) { errno = err; return -1; }
+    if (in != -1) err = posix_spawn_file_actions_adddup2(&fa, in, 0);
+    if (!err && out != -1) err = posix_spawn_file_actions_adddup2(&fa, out, 1);
+    if (!err) err = posix_spawnp(&pid, file, &fa, NULL, argv, environ);
+    posix_spawn_file_actions_destroy(&fa);
+    if (err) { errno = err; return -1; }
+    return pid;
+}
+
+/*
+ * Child pid of every open ft_popen fd, indexed by fd. A slot is reserved
+ * before launching so that recording the pid afterwards cannot fail.
+ */
+pthread_mutex_t g_popen_lock = PTHREAD_MUTEX_INITIALIZER;
+pid_t *g_popen_pids;
+int g_popen_cap;
+
+int track_reserve(int fd)
+{
+    int ret = 0;
+    pthread_mutex_lock(&g_popen_lock);
+    if (fd >= g_popen_cap)
+    {
+        int cap = g_popen_cap ? g_popen_cap : 64;
+        while (cap <= fd) cap *= 2;
+        pid_t *pids = realloc(g_popen_pids, cap * sizeof(pid_t));
+        if (!pids) ret = -1;
+        else
+        {
+            memset(pids + g_popen_cap, 0, (cap - g_popen_cap) * sizeof(pid_t));
+            g_popen_pids = pids;
+            g_popen_cap = cap;
+        }
+    }
+    pthread_mutex_unlock(&g_popen_lock);
+    return ret;
+}
+
+void track_set(int fd, pid_t pid)
+{
+    pthread_mutex_lock(&g_popen_lock);
+    g_popen_pids[fd] = pid;
+    pthread_mutex_unlock(&g_popen_lock);
+}
+
+pid_t track_take(int fd)
+{
+    pid_t pid = 0;
+    pthread_mutex_lock(&g_popen_lock);
+    if (fd >= 0 && fd < g_popen_cap)
+    {
+        pid = g_popen_pids[fd];
+        g_popen_pids[fd] = 0;
+    }
+    pthread_mutex_unlock(&g_popen_lock);
+    return pid;
+}
 
 int ft_popen(const char *file, char *const argv[], char type)
 {
     if (type != 'r' && type != 'w') return -1;
     if (!file || !argv || !argv[0]) return -1;
     int pipefd[2];
-    if (pipe(pipefd) == -1) return -1;
+    if (pipe2(pipefd, O_CLOEXEC) == -1) return -1;
 
-    pid_t pid = fork();
-    if (pid == -1)
+    int keep = type == 'r' ? pipefd[0] : pipefd[1];
+    int give = type == 'r' ? pipefd[1] : pipefd[0];
+    pid_t pid = -1;
+    if (track_reserve(keep) == -1
+        || (pid = launch(file, argv, type == 'w' ? give : -1, type == 'r' ? give : -1)) == -1)
     {
         close(pipefd[0]);
         close(pipefd[1]);
         return -1;
     }
-    if (pid == 0)
+    track_set(keep, pid);
+    close(give);
+    return keep;
+}
+
+/*
+ * Bidirectional variant for coprocesses: fds[0] reads the command's
+ * stdout and fds[1] writes its stdin. Returns 0, or -1 on error.
+ * The child is tracked under fds[0]: close fds[1] before ft_pclose(fds[0]).
+ */
+int ft_popen2(const char *file, char *const argv[], int fds[2])
+{
+    if (!file || !argv || !argv[0] || !fds) return -1;
+    int out[2], in[2];
+    if (pipe2(out, O_CLOEXEC) == -1) return -1;
+    if (pipe2(in, O_CLOEXEC) == -1) { close(out[0]); close(out[1]); return -1; }
+    pid_t pid = -1;
+    if (track_reserve(out[0]) == -1 || (pid = launch(file, argv, in[0], out[1])) == -1)
+    {
+        close(out[0]); close(out[1]);
+        close(in[0]); close(in[1]);
+        return -1;
+    }
+    track_set(out[0], pid);
+    close(in[0]);
+    close(out[1]);
+    fds[0] = out[0];
+    fds[1] = in[1];
+    return 0;
+}
+
+/*
+ * Closes an fd returned by ft_popen (or fds[0] of ft_popen2) and reaps its
+ * child. Returns the child's wait status, or -1 if fd is not tracked.
+ */
+int ft_pclose(int fd)
+{
+    pid_t pid = track_take(fd);
+    if (pid <= 0) { errno = EBADF; return -1; }
+    close(fd);
+    int status;
+    pid_t r;
+    while ((r = waitpid(pid, &status, 0)) == -1 && errno == EINTR);
+    return r == -1 ? -1 : status;
+}
+
+/*
+ * Pool of pre-started coprocesses of one command. pool_acquire() hands
+ * out a ready coprocess' fds instead of launching one. pool_release()
+ * puts it back if the protocol left it ready for another request, or
+ * closes its input so it can exit, and a replacer thread then launches
+ * its successor and reaps it, away from the request path.
+ */
+enum e_slot_state
+{
+    SLOT_READY,
+    SLOT_BUSY,          // handed out, or being replaced
+    SLOT_STALE,         // input closed by pool_release, waiting for the replacer
+    SLOT_DEAD           // no coprocess: its launch failed
+};
+
+typedef struct s_pool_slot
+{
+    int fds[2];         // as returned by ft_popen2, -1 when the slot is dead
+    enum e_slot_state state;
+} t_pool_slot;
+
+typedef struct s_popen_pool
+{
+    const char *file;
+    char *const *argv;  // borrowed: must outlive the pool
+    int size;
+    t_pool_slot *slots;
+    pthread_mutex_t lock;
+    pthread_cond_t idle;    // a slot became ready or dead
+    pthread_cond_t stale;   // a slot needs replacing, or the pool stops
+    bool stopping;
+    bool has_replacer;
+    pthread_t replacer;
+} t_popen_pool;
+
+void pool_stop(t_pool_slot *slot)
+{
+    if (slot->fds[0] == -1) return;
+    if (slot->fds[1] != -1) close(slot->fds[1]);
+    ft_pclose(slot->fds[0]);
+    slot->fds[0] = slot->fds[1] = -1;
+}
+
+// Launches the successor first so that it is ready while the old one exits
+void *pool_replace(void *arg)
+{
+    t_popen_pool *pool = arg;
+    pthread_mutex_lock(&pool->lock);
+    // stale slots left at stop are reaped by pool_destroy()
+    while (!pool->stopping)
+    {
+        int pick = -1;
+        for (int i = 0; i < pool->size && pick == -1; i++)
+            if (pool->slots[i].state == SLOT_STALE) pick = i;
+        if (pick == -1)
+        {
+            pthread_cond_wait(&pool->stale, &pool->lock);
+            continue;
+        }
+        t_pool_slot *slot = &pool->slots[pick];
+        slot->state = SLOT_BUSY;
+        pthread_mutex_unlock(&pool->lock);
+        int fresh[2];
+        bool launched = ft_popen2(pool->file, pool->argv, fresh) != -1;
+        int old = slot->fds[0];
+        pthread_mutex_lock(&pool->lock);
+        slot->fds[0] = launched ? fresh[0] : -1;
+        slot->fds[1] = launched ? fresh[1] : -1;
+        slot->state = launched ? SLOT_READY : SLOT_DEAD;
+        pthread_cond_signal(&pool->idle);
+        pthread_mutex_unlock(&pool->lock);
+        ft_pclose(old);
+        pthread_mutex_lock(&pool->lock);
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+}
+
+void pool_destroy(t_popen_pool *pool)
+{
+    if (pool->has_replacer)
     {
-        if (type == 'r')
+        pthread_mutex_lock(&pool->lock);
+        pool->stopping = true;
+        pthread_cond_signal(&pool->stale);
+        pthread_mutex_unlock(&pool->lock);
+        pthread_join(pool->replacer, NULL);
+    }
+    for (int i = 0; i < pool->size; i++)
+        pool_stop(&pool->slots[i]);
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->idle);
+    pthread_cond_destroy(&pool->stale);
+    free(pool->slots);
+    free(pool);
+}
+
+t_popen_pool *ft_popen_pool(const char *file, char *const argv[], int size)
+{
+    if (!file || !argv || !argv[0] || size <= 0) return NULL;
+    t_popen_pool *pool = calloc(1, sizeof(t_popen_pool));
+    if (!pool) return NULL;
+    *pool = (t_popen_pool){.file = file, .argv = argv, .size = size,
+        .lock = PTHREAD_MUTEX_INITIALIZER, .idle = PTHREAD_COND_INITIALIZER,
+        .stale = PTHREAD_COND_INITIALIZER};
+    pool->slots = calloc(size, sizeof(t_pool_slot));
+    if (!pool->slots) { free(pool); return NULL; }
+    for (int i = 0; i < size; i++)
+        pool->slots[i].fds[0] = pool->slots[i].fds[1] = -1;
+    for (int i = 0; i < size; i++)
+        if (ft_popen2(file, argv, pool->slots[i].fds) == -1)
         {
-            close(pipefd[0]);
-            dup2(pipefd[1], 1);
-            close(pipefd[1]);
+            pool_destroy(pool);
+            return NULL;
         }
-        else
+    pool->has_replacer = !pthread_create(&pool->replacer, NULL, pool_replace, pool);
+    if (!pool->has_replacer)
+    {
+        pool_destroy(pool);
+        return NULL;
+    }
+    return pool;
+}
+
+/*
+ * Blocks until a coprocess is ready, stores its fds in fds and returns its
+ * slot for pool_release(). The pool keeps ownership of the fds. A dead
+ * slot is only relaunched here when no coprocess is ready, and -1 is
+ * returned if that launch fails.
+ */
+int pool_acquire(t_popen_pool *pool, int fds[2])
+{
+    pthread_mutex_lock(&pool->lock);
+    int pick = -1;
+    while (pick == -1)
+    {
+        for (int i = 0; i < pool->size; i++)
         {
-            close(pipefd[1]);
-            dup2(pipefd[0], 0);
-            close(pipefd[0]);
+            enum e_slot_state state = pool->slots[i].state;
+            if (state == SLOT_READY || (state == SLOT_DEAD && pick == -1)) pick = i;
+            if (state == SLOT_READY) break;
         }
-        execvp(file, argv);
-        exit(1);
+        if (pick == -1)
+            pthread_cond_wait(&pool->idle, &pool->lock);
     }
-    if (type == 'r')
+    t_pool_slot *slot = &pool->slots[pick];
+    bool dead = slot->state == SLOT_DEAD;
+    slot->state = SLOT_BUSY;
+    pthread_mutex_unlock(&pool->lock);
+    if (dead && ft_popen2(pool->file, pool->argv, slot->fds) == -1)
     {
-        close(pipefd[1]);
-        return pipefd[0];
+        pthread_mutex_lock(&pool->lock);
+        slot->state = SLOT_DEAD;
+        pthread_cond_signal(&pool->idle);
+        pthread_mutex_unlock(&pool->lock);
+        return -1;
     }
-    else
+    fds[0] = slot->fds[0];
+    fds[1] = slot->fds[1];
+    return pick;
+}
+
+// reusable: the coprocess can serve another request as it is
+void pool_release(t_popen_pool *pool, int slot, bool reusable)
+{
+    if (slot < 0 || slot >= pool->size) return;
+    t_pool_slot *s = &pool->slots[slot];
+    if (!reusable)
     {
-        close(pipefd[0]);
-        return pipefd[1];
+        // EOF lets it exit now; the replacer reaps it
+        close(s->fds[1]);
+        s->fds[1] = -1;
+    }
+    pthread_mutex_lock(&pool->lock);
+    s->state = reusable ? SLOT_READY : SLOT_STALE;
+    pthread_cond_signal(reusable ? &pool->idle : &pool->stale);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+/*
+ * Line reader over an fd: reads READER_CHUNK bytes at a time and splits
+ * lines with memchr instead of reading byte by byte.
+ */
+#define READER_CHUNK (1 << 16)
+
+typedef struct s_reader
+{
+    int fd;
+    char *buf;
+    size_t start;
+    size_t end;
+    size_t cap;
+} t_reader;
+
+void reader_init(t_reader *r, int fd)
+{
+    *r = (t_reader){.fd = fd};
+}
+
+void reader_free(t_reader *r)
+{
+    free(r->buf);
+    r->buf = NULL;
+}
+
+/*
+ * Returns the next line, '\n' included if present, and stores its length
+ * in len. The line lives in the reader's buffer: it is not NUL-terminated
+ * and stays valid until the next call. NULL at end of input or on error.
+ */
+char *reader_line(t_reader *r, size_t *len)
+{
+    size_t scanned = r->start;
+    for (;;)
+    {
+        char *nl = r->buf ? memchr(r->buf + scanned, '\n', r->end - scanned) : NULL;
+        if (nl || (r->fd == -1 && r->end > r->start))
+        {
+            char *line = r->buf + r->start;
+            *len = nl ? (size_t)(nl + 1 - line) : r->end - r->start;
+            r->start += *len;
+            return line;
+        }
+        if (r->fd == -1) return NULL;
+        scanned = r->end - r->start;
+        if (r->start)
+        {
+            memmove(r->buf, r->buf + r->start, r->end - r->start);
+            r->end -= r->start;
+            r->start = 0;
+        }
+        if (r->cap - r->end < READER_CHUNK)
+        {
+            size_t cap = r->cap ? r->cap * 2 : READER_CHUNK * 2;
+            char *buf = realloc(r->buf, cap);
+            if (!buf) return NULL;
+            r->buf = buf;
+            r->cap = cap;
+        }
+        ssize_t n = read(r->fd, r->buf + r->end, r->cap - r->end);
+        if (n == -1 && errno == EINTR) continue;
+        if (n <= 0) r->fd = -1;
+        else r->end += n;
     }
 }
 
 /*
 int main()
 {
-    int  fd;
-    char *line;
+    int      fds[2];
+    t_reader reader;
+    char     *line;
+    size_t   len;
 
-    fd = ft_popen("ls", (char *const []){"ls", NULL}, 'r');
-    while ((line = get_next_line(fd)))
-        ft_putstr(line);
-    return (0);
+    if (ft_popen2("sort", (char *const []){"sort", NULL}, fds) == -1)
+        return (1);
+    write(fds[1], "b\na\n", 4);
+    close(fds[1]);
+    reader_init(&reader, fds[0]);
+    while ((line = reader_line(&reader, &len)))
+        write(1, line, len);
+    reader_free(&reader);
+    return (ft_pclose(fds[0]) == 0 ? 0 : 1);
 }
-*/
\ No newline at end of file
+*/
@@ -1,53 +1,590 @@
+#define _GNU_SOURCE
 #include <unistd.h>
 #include <sys/wait.h>
 #include <stdlib.h>
+#include <stdbool.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <pthread.h>
+#include <spawn.h>
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <sys/eventfd.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdatomic.h>
 
-int picoshell(char **cmds[])
+extern char **environ;
+
+#define RELAY_CHUNK (1 << 16)
+
+typedef struct s_stage_result
 {
-    int count = 0;
-    while (cmds[count]) count++;
-    if (count == 0) return 0;
-    int prev_read = -1;
-    for (int i = 0; i < count; i++)
+    pid_t pid;              // 0 for a builtin or a stage that never started
+    int status;             // wait status, -1 if the stage never started
+    struct rusage usage;    // CPU time, max RSS, context switches...
+} t_stage_result;
+
+/*
+ * Optional tuning for picoshell_opts(). Arrays describe the link after
+ * stage i, so they hold count - 1 entries.
+ */
+typedef struct s_pico_opts
+{
+    const int *pipe_size;   // F_SETPIPE_SZ per link, 0 keeps the default
+    bool relay;             // forward every link through an in-process splice relay
+    const int *tap;         // pipe write end receiving a tee() copy of a link, or -1
+    size_t *bytes;          // filled with the bytes moved across each relayed link
+    t_stage_result *results;    // count entries, filled once every stage is reaped
+    bool teardown;          // SIGTERM the other stages as soon as one fails
+    bool builtins;          // run registered builtins as threads instead of execvp
+} t_pico_opts;
+
+typedef struct s_relay
+{
+    int in;
+    int out;
+    int tap;
+    size_t moved;
+    pthread_t tid;
+    bool running;
+} t_relay;
+
+int open_link(int fds[2], int size)
+{
+    if (pipe2(fds, O_CLOEXEC) == -1) return -1;
+    // best effort: the kernel caps it at /proc/sys/fs/pipe-max-size
+    if (size > 0) fcntl(fds[1], F_SETPIPE_SZ, size);
+    return 0;
+}
+
+void *relay_run(void *arg)
+{
+    t_relay *r = arg;
+    sigset_t set;
+    sigemptyset(&set);
+    sigaddset(&set, SIGPIPE);
+    pthread_sigmask(SIG_BLOCK, &set, NULL);
+
+    size_t pending = 0;     // teed to the tap but not forwarded yet
+    for (;;)
     {
-        int pipefd[2] = {-1, -1};
-        if (i < count - 1 && pipe(pipefd) == -1)
+        ssize_t n = pending ? (ssize_t)pending : RELAY_CHUNK;
+        if (r->tap >= 0 && !pending && (n = tee(r->in, r->tap, RELAY_CHUNK, 0)) > 0)
+            pending = n;
+        if (n == -1)
         {
-            if (prev_read != -1) close(prev_read);
-            return 1;
+            // a broken tap must not stall the pipeline
+            if (errno != EINTR) r->tap = -1;
+            continue;
         }
-        pid_t pid = fork();
-        if (pid == -1)
+        if (n == 0) break;
+        ssize_t moved = splice(r->in, NULL, r->out, NULL, n, SPLICE_F_MOVE);
+        if (moved == -1 && errno == EINTR) continue;
+        if (moved <= 0) break;
+        r->moved += moved;
+        if (pending) pending -= moved;
+    }
+    close(r->in);
+    close(r->out);
+    return NULL;
+}
+
+int start_relay(t_relay *r, int in, int *read_end, int size, int tap)
+{
+    int fds[2];
+    if (open_link(fds, size) == -1) return -1;
+    *r = (t_relay){.in = in, .out = fds[1], .tap = tap};
+    if (pthread_create(&r->tid, NULL, relay_run, r))
+    {
+        close(fds[0]);
+        close(fds[1]);
+        return -1;
+    }
+    r->running = true;
+    *read_end = fds[0];
+    return 0;
+}
+
+/*
+ * Starts argv with stdin/stdout redirected to in/out (-1 keeps the parent's).
+ * posix_spawn runs on a vfork-style clone, so launch time does not grow with
+ * the parent's memory. Pipes are O_CLOEXEC: only the dup2'd copies survive.
+ */
+pid_t launch(char **argv, int in, int out)
+{
+    posix_spawn_file_actions_t fa;
+    pid_t pid;
+    int err = posix_spawn_file_actions_init(&fa);
+    if (err) { errno = err; return -1; }
+    if (in != -1) err = posix_spawn_file_actions_adddup2(&fa, in, 0);
+    if (!err && out != -1) err = posix_spawn_file_actions_adddup2(&fa, out, 1);
+    if (!err) err = posix_spawnp(&pid, argv[0], &fa, NULL, argv, environ);
+    posix_spawn_file_actions_destroy(&fa);
+    if (err) { errno = err; return -1; }
+    return pid;
+}
+
+/*
+ * In-process builtins, run as threads on the stage's fds instead of a
+ * fork+exec. accepts() says whether the builtin implements this argv;
+ * anything else still goes to execvp.
+ */
+#define BUILTIN_CHUNK (1 << 16)
+#define BUILTIN_SIGPIPE -1      // run() result for a reader that went away
+#define BUILTIN_MAX 32
+
+typedef struct s_builtin
+{
+    const char *name;
+    bool (*accepts)(char **argv);
+    int (*run)(int in, int out, char **argv);
+} t_builtin;
+
+ssize_t read_retry(int fd, char *buf, size_t len)
+{
+    ssize_t n;
+    while ((n = read(fd, buf, len)) == -1 && errno == EINTR);
+    return n;
+}
+
+int write_all(int fd, const char *buf, size_t len)
+{
+    while (len)
+    {
+        ssize_t n = write(fd, buf, len);
+        if (n == -1 && errno == EINTR) continue;
+        if (n == -1) return -1;
+        buf += n;
+        len -= n;
+    }
+    return 0;
+}
+
+int write_failed(void)
+{
+    return errno == EPIPE ? BUILTIN_SIGPIPE : 1;
+}
+
+bool cat_accepts(char **argv)
+{
+    return !argv[1] || (!strcmp(argv[1], "-") && !argv[2]);
+}
+
+int cat_run(int in, int out, char **argv)
+{
+    (void)argv;
+    ssize_t n;
+    // pipe to pipe needs no copy through user space
+    while ((n = splice(in, NULL, out, NULL, BUILTIN_CHUNK, SPLICE_F_MOVE)) > 0
+        || (n == -1 && errno == EINTR));
+    if (n == 0) return 0;
+    if (errno != EINVAL) return write_failed();
+    char buf[BUILTIN_CHUNK];
+    while ((n = read_retry(in, buf, sizeof buf)) > 0)
+        if (write_all(out, buf, n) == -1) return write_failed();
+    return n == 0 ? 0 : 1;
+}
+
+// head, head -n N or head -nN
+bool head_lines(char **argv, long *lines)
+{
+    *lines = 10;
+    if (!argv[1]) return true;
+    const char *arg = argv[1];
+    if (strncmp(arg, "-n", 2)) return false;
+    arg = arg[2] ? arg + 2 : argv[2];
+    if (!arg || (arg == argv[2] ? argv[3] : argv[2])) return false;
+    char *end;
+    *lines = strtol(arg, &end, 10);
+    return *arg && !*end && *lines >= 0;
+}
+
+bool head_accepts(char **argv)
+{
+    long lines;
+    return head_lines(argv, &lines);
+}
+
+int head_run(int in, int out, char **argv)
+{
+    long lines;
+    head_lines(argv, &lines);
+    char buf[BUILTIN_CHUNK];
+    ssize_t n = 0;
+    while (lines > 0 && (n = read_retry(in, buf, sizeof buf)) > 0)
+    {
+        char *p = buf, *end = buf + n;
+        while (lines > 0 && (p = memchr(p, '\n', end - p))) { p++; lines--; }
+        size_t len = lines > 0 ? (size_t)n : (size_t)(p - buf);
+        if (write_all(out, buf, len) == -1) return write_failed();
+    }
+    return n == -1 ? 1 : 0;
+}
+
+bool wc_accepts(char **argv)
+{
+    return argv[1] && !strcmp(argv[1], "-l") && !argv[2];
+}
+
+int wc_run(int in, int out, char **argv)
+{
+    (void)argv;
+    char buf[BUILTIN_CHUNK];
+    size_t lines = 0;
+    ssize_t n;
+    while ((n = read_retry(in, buf, sizeof buf)) > 0)
+        for (char *p = buf, *end = buf + n; (p = memchr(p, '\n', end - p)); p++)
+            lines++;
+    if (n == -1) return 1;
+    int len = snprintf(buf, sizeof buf, "%zu\n", lines);
+    return write_all(out, buf, len) == -1 ? write_failed() : 0;
+}
+
+// tee FILE... without options
+bool tee_accepts(char **argv)
+{
+    for (int i = 1; argv[i]; i++)
+        if (argv[i][0] == '-') return false;
+    return true;
+}
+
+int tee_run(int in, int out, char **argv)
+{
+    int count = 0, ret = 0;
+    while (argv[count + 1]) count++;
+    int *fds = malloc((count + 1) * sizeof(int));
+    if (!fds) return 1;
+    for (int i = 0; i < count; i++)
+        if ((fds[i] = open(argv[i + 1], O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666)) == -1)
+            ret = 1;
+    char buf[BUILTIN_CHUNK];
+    ssize_t n;
+    while ((n = read_retry(in, buf, sizeof buf)) > 0)
+    {
+        if (write_all(out, buf, n) == -1) { ret = write_failed(); break; }
+        for (int i = 0; i < count; i++)
+            if (fds[i] != -1 && write_all(fds[i], buf, n) == -1) { close(fds[i]); fds[i] = -1; ret = 1; }
+    }
+    if (n == -1) ret = 1;
+    for (int i = 0; i < count; i++)
+        if (fds[i] != -1) close(fds[i]);
+    free(fds);
+    return ret;
+}
+
+t_builtin g_builtins[BUILTIN_MAX] = {
+    {"cat", cat_accepts, cat_run},
+    {"head", head_accepts, head_run},
+    {"wc", wc_accepts, wc_run},
+    {"tee", tee_accepts, tee_run},
+};
+int g_builtin_count = 4;
+
+// Adds or replaces a builtin; not thread-safe against running pipelines
+int picoshell_register(const char *name, bool (*accepts)(char **argv), int (*run)(int in, int out, char **argv))
+{
+    int i = 0;
+    while (i < g_builtin_count && strcmp(g_builtins[i].name, name)) i++;
+    if (i == BUILTIN_MAX) return -1;
+    g_builtins[i] = (t_builtin){name, accepts, run};
+    if (i == g_builtin_count) g_builtin_count++;
+    return 0;
+}
+
+const t_builtin *find_builtin(char **argv)
+{
+    for (int i = 0; i < g_builtin_count; i++)
+        if (!strcmp(g_builtins[i].name, argv[0]))
+            return !g_builtins[i].accepts || g_builtins[i].accepts(argv) ? &g_builtins[i] : NULL;
+    return NULL;
+}
+
+// A stage killed by SIGPIPE only lost its reader, which is not a failure
+bool stage_failed(int status)
+{
+    if (WIFSIGNALED(status)) return WTERMSIG(status) != SIGPIPE;
+    return !WIFEXITED(status) || WEXITSTATUS(status) != 0;
+}
+
+typedef struct s_stage
+{
+    int pidfd;      // for a builtin, an eventfd it signals on return; -1 if unavailable
+    bool running;
+    const t_builtin *def;   // NULL for an exec'd stage
+    char **argv;
+    int in;         // -1 when the builtin uses the parent's stdin/stdout
+    int out;
+    int status;
+    struct rusage usage;
+    atomic_bool done;
+    pthread_t tid;
+} t_stage;
+
+void *builtin_run(void *arg)
+{
+    t_stage *s = arg;
+    sigset_t set;
+    sigemptyset(&set);
+    sigaddset(&set, SIGPIPE);
+    pthread_sigmask(SIG_BLOCK, &set, NULL);
+
+    int ret = s->def->run(s->in == -1 ? 0 : s->in, s->out == -1 ? 1 : s->out, s->argv);
+    // encoded like a wait status, so results look the same as for a process
+    s->status = ret == BUILTIN_SIGPIPE ? SIGPIPE : (ret & 0xff) << 8;
+    getrusage(RUSAGE_THREAD, &s->usage);
+    if (s->in != -1) close(s->in);
+    if (s->out != -1) close(s->out);
+    // done first: a reaper woken by the eventfd must find it set
+    atomic_store(&s->done, true);
+    if (s->pidfd != -1) eventfd_write(s->pidfd, 1);
+    return NULL;
+}
+
+int start_builtin(t_stage *s, const t_builtin *def, char **argv, int in, int out)
+{
+    *s = (t_stage){.pidfd = eventfd(0, EFD_CLOEXEC), .running = true,
+        .def = def, .argv = argv, .in = in, .out = out};
+    if (pthread_create(&s->tid, NULL, builtin_run, s))
+    {
+        if (s->pidfd != -1) close(s->pidfd);
+        *s = (t_stage){.pidfd = -1};
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * A started pipeline. Stages are reaped by their own pids, never through
+ * wait(), so the caller's other children are left alone.
+ */
+typedef struct s_pipeline
+{
+    int count;
+    int live;
+    int ret;                // picoshell's return value
+    t_stage *stages;
+    t_stage_result *res;
+    t_relay *relays;
+    t_pico_opts opts;
+} t_pipeline;
+
+// Collects stage i if it has exited (or waits for it without WNOHANG)
+bool reap_stage(t_pipeline *p, int i, int flags)
+{
+    t_stage *s = &p->stages[i];
+    int status = 0;
+    struct rusage usage;
+    pid_t r = 1;
+    if (s->def)
+    {
+        if ((flags & WNOHANG) && !atomic_load(&s->done)) return false;
+        pthread_join(s->tid, NULL);
+        status = s->status;
+        usage = s->usage;
+    }
+    else
+        while ((r = wait4(p->res[i].pid, &status, flags, &usage)) == -1 && errno == EINTR);
+    if (r == 0) return false;
+    if (r > 0) { p->res[i].status = status; p->res[i].usage = usage; }
+    if (p->stages[i].pidfd != -1) close(p->stages[i].pidfd);
+    p->stages[i] = (t_stage){.pidfd = -1};
+    p->live--;
+    if (r > 0 && p->opts.teardown && stage_failed(status))
+        for (int j = 0; j < p->count; j++)
+            if (p->stages[j].running && !p->stages[j].def) kill(p->res[j].pid, SIGTERM);
+    return true;
+}
+
+/*
+ * Launches every stage and returns at once. Only a failed allocation
+ * returns NULL; a launch error is reported by pipeline_finish(), which
+ * must still be called to reap what did start. Arrays in opts must stay
+ * valid until then.
+ */
+t_pipeline *pipeline_start(char **cmds[], const t_pico_opts *opts)
+{
+    t_pipeline *p = calloc(1, sizeof(t_pipeline));
+    if (!p) return NULL;
+    while (cmds[p->count]) p->count++;
+    if (opts) p->opts = *opts;
+    if (p->count == 0) return p;
+    p->stages = calloc(p->count, sizeof(t_stage));
+    p->res = calloc(p->count, sizeof(t_stage_result));
+    p->relays = calloc(p->count, sizeof(t_relay));
+    if (!p->stages || !p->res || !p->relays)
+    {
+        free(p->stages); free(p->res); free(p->relays); free(p);
+        return NULL;
+    }
+    for (int i = 0; i < p->count; i++)
+    {
+        p->stages[i].pidfd = -1;
+        p->res[i].status = -1;
+    }
+
+    int prev_read = -1, count = p->count;
+    for (int i = 0; i < count; i++)
+    {
+        int pipefd[2] = {-1, -1};
+        int size = p->opts.pipe_size && i < count - 1 ? p->opts.pipe_size[i] : 0;
+        if (i < count - 1 && open_link(pipefd, size) == -1) { p->ret = 1; break; }
+        const t_builtin *def = p->opts.builtins ? find_builtin(cmds[i]) : NULL;
+        pid_t pid = 0;
+        if (def ? start_builtin(&p->stages[i], def, cmds[i], prev_read, pipefd[1]) == -1
+            : (pid = launch(cmds[i], prev_read, pipefd[1])) == -1)
         {
             if (pipefd[0] != -1) { close(pipefd[0]); close(pipefd[1]); }
-            if (prev_read != -1) close(prev_read);
-            return 1;
+            p->ret = 1;
+            break;
         }
-        if (pid == 0)
+        p->res[i].pid = pid;
+        if (!def) p->stages[i] = (t_stage){.pidfd = syscall(SYS_pidfd_open, pid, 0), .running = true};
+        p->live++;
+        // a builtin owns its fds and closes them itself
+        if (prev_read != -1 && !def) close(prev_read);
+        prev_read = -1;
+        if (i == count - 1) break;
+        if (!def) close(pipefd[1]);
+        prev_read = pipefd[0];
+        int tap = p->opts.tap ? p->opts.tap[i] : -1;
+        if (p->opts.relay || tap >= 0)
         {
-            if (prev_read != -1)
-            {
-                dup2(prev_read, 0);
-                close(prev_read);
-            }
-            if (i < count - 1)
+            if (start_relay(&p->relays[i], pipefd[0], &prev_read, size, tap) == -1)
             {
-                dup2(pipefd[1], 1);
-                close(pipefd[0]);
-                close(pipefd[1]);
+                p->ret = 1;
+                break;
             }
-            execvp(cmds[i][0], cmds[i]);
-            exit(1);
         }
-        if (prev_read != -1) close(prev_read);
-        if (i < count - 1)
+    }
+    if (prev_read != -1) close(prev_read);
+    return p;
+}
+
+// pidfd of a stage, or -1 once it is reaped or if pidfds are unsupported
+int pipeline_pidfd(const t_pipeline *p, int stage)
+{
+    return stage >= 0 && stage < p->count ? p->stages[stage].pidfd : -1;
+}
+
+/*
+ * Registers every running stage's pidfd with epfd, tagged with `data`.
+ * When epoll reports one readable, call pipeline_reap(p); reaping closes
+ * the pidfd, which also drops it from the epoll set.
+ */
+int pipeline_watch(t_pipeline *p, int epfd, epoll_data_t data)
+{
+    for (int i = 0; i < p->count; i++)
+    {
+        if (!p->stages[i].running) continue;
+        struct epoll_event ev = {.events = EPOLLIN, .data = data};
+        if (p->stages[i].pidfd == -1) errno = ENOSYS;
+        if (p->stages[i].pidfd == -1 || epoll_ctl(epfd, EPOLL_CTL_ADD, p->stages[i].pidfd, &ev) == -1)
+        {
+            // all or nothing, so an unwatched pipeline never shows up in epfd
+            int err = errno;
+            for (int j = 0; j < i; j++)
+                if (p->stages[j].running) epoll_ctl(epfd, EPOLL_CTL_DEL, p->stages[j].pidfd, NULL);
+            errno = err;
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// Reaps whichever stages have exited without blocking; true once none is left
+bool pipeline_reap(t_pipeline *p)
+{
+    for (int i = 0; i < p->count; i++)
+        if (p->stages[i].running) reap_stage(p, i, WNOHANG);
+    return p->live == 0;
+}
+
+/*
+ * Waits for the remaining stages, in exit order when pidfds are available
+ * so that teardown happens promptly, then joins the relays, fills the
+ * caller's results and frees p. Returns what picoshell() would.
+ */
+int pipeline_finish(t_pipeline *p)
+{
+    struct pollfd *pfds = p->count ? calloc(p->count, sizeof(struct pollfd)) : NULL;
+    while (p->live)
+    {
+        int n = 0;
+        for (int i = 0; pfds && i < p->count; i++)
+            if (p->stages[i].running && p->stages[i].pidfd != -1)
+                pfds[n++] = (struct pollfd){.fd = p->stages[i].pidfd, .events = POLLIN};
+        if (n < p->live)
         {
-            close(pipefd[1]);
-            prev_read = pipefd[0];
+            for (int i = 0; i < p->count; i++)
+                if (p->stages[i].running) reap_stage(p, i, 0);
+            continue;
         }
+        if (poll(pfds, n, -1) == -1 && errno != EINTR) { free(pfds); pfds = NULL; continue; }
+        pipeline_reap(p);
     }
-    if (prev_read != -1) close(prev_read);
-    for (int i = 0; i < count; i++)
-        wait(NULL);
+    free(pfds);
+    for (int i = 0; i < p->count; i++)
+    {
+        if (p->relays[i].running) pthread_join(p->relays[i].tid, NULL);
+        if (p->opts.bytes && i < p->count - 1) p->opts.bytes[i] = p->relays[i].moved;
+        if (p->opts.results) p->opts.results[i] = p->res[i];
+    }
+    int ret = p->ret;
+    free(p->stages); free(p->res); free(p->relays); free(p);
+    return ret;
+}
+
+/*
+ * Supervises n pipelines from one thread with a single epoll set and
+ * stores each one's picoshell() return value in rets. Pipelines whose
+ * pidfds cannot be watched are finished in turn after the others.
+ */
+int pipelines_wait(t_pipeline **ps, int n, int *rets)
+{
+    int epfd = epoll_create1(EPOLL_CLOEXEC);
+    int pending = 0;
+    for (int i = 0; i < n; i++)
+    {
+        // unwatched pipelines are left for the final loop below
+        if (epfd == -1 || pipeline_watch(ps[i], epfd, (epoll_data_t){.u64 = i}) == -1)
+            continue;
+        if (!pipeline_reap(ps[i])) pending++;
+        else { rets[i] = pipeline_finish(ps[i]); ps[i] = NULL; }
+    }
+    struct epoll_event events[64];
+    while (pending > 0)
+    {
+        int ready = epoll_wait(epfd, events, 64, -1);
+        if (ready == -1 && errno == EINTR) continue;
+        if (ready == -1) break;
+        for (int e = 0; e < ready; e++)
+        {
+            // several pidfds of one pipeline may be reported in one batch
+            int i = events[e].data.u64;
+            if (!ps[i] || !pipeline_reap(ps[i])) continue;
+            rets[i] = pipeline_finish(ps[i]);
+            ps[i] = NULL;
+            pending--;
+        }
+    }
+    for (int i = 0; i < n; i++)
+        if (ps[i]) { rets[i] = pipeline_finish(ps[i]); ps[i] = NULL; }
+    if (epfd != -1) close(epfd);
     return 0;
-}
\ No newline at end of file
+}
+
+int picoshell_opts(char **cmds[], const t_pico_opts *opts)
+{
+    t_pipeline *p = pipeline_start(cmds, opts);
+    if (!p) return 1;
+    return pipeline_finish(p);
+}
+
+int picoshell(char **cmds[])
+{
+    return picoshell_opts(cmds, NULL);
+}
@@ -1,3 +1,4 @@
+#define _GNU_SOURCE
 #include <unistd.h>
 #include <sys/wait.h>
 #include <signal.h>
@@ -6,57 +7,460 @@
 #include <errno.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/syscall.h>
+#include <sys/resource.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/prctl.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <stdatomic.h>
 
-int sandbox(void (*f)(void), unsigned int timeout, bool verbose)
+#define NS_PER_SEC 1000000000LL
+
+typedef struct s_sandbox_result
+{
+    int verdict;            // 1 nice, 0 bad, -1 error in the sandbox itself
+    int status;             // wait status of the child
+    bool timed_out;
+    long long wall_ns;      // fork to reap, on the monotonic clock
+    struct rusage usage;    // the child's own: CPU time, ru_maxrss, page faults...
+    int limit_hit;          // RLIMIT_* that stopped f, -1 if none
+} t_sandbox_result;
+
+// Applied with setrlimit in the child before f runs; 0 leaves one unset
+typedef struct s_sandbox_limits
+{
+    rlim_t as;              // bytes of address space
+    rlim_t cpu;             // seconds of CPU time
+    rlim_t nofile;          // open file descriptors
+} t_sandbox_limits;
+
+typedef struct s_sandbox_job
+{
+    void (*f)(void);
+    long long timeout_ns;   // 0 for none
+    const t_sandbox_limits *limits;     // NULL for none
+    t_sandbox_result result;
+} t_sandbox_job;
+
+typedef struct s_child
+{
+    pid_t pid;      // 0 once reaped
+    int pidfd;      // or the read end of its exit pipe, see exit_fd()
+    int timerfd;    // -1 without a timeout
+    long long start_ns;
+    int *last_errno;    // shared with the child, see track_errno()
+} t_child;
+
+/*
+ * A failed malloc or open leaves no trace in a wait status, so a limited
+ * child copies errno to a page shared with the parent when f exits or
+ * dies. ENOMEM then points at RLIMIT_AS and EMFILE at RLIMIT_NOFILE.
+ */
+int *g_last_errno;
+
+void save_errno(void)
+{
+    *g_last_errno = errno;
+}
+
+// SA_RESETHAND has restored the default action, so raise() still kills
+void save_errno_and_die(int sig)
 {
+    save_errno();
+    raise(sig);
+}
+
+void track_errno(int *slot)
+{
+    int fatal[] = {SIGSEGV, SIGBUS, SIGABRT, SIGFPE, SIGILL};
+    struct sigaction sa = {.sa_handler = save_errno_and_die, .sa_flags = SA_RESETHAND | SA_NODEFER};
+    sigemptyset(&sa.sa_mask);
+    g_last_errno = slot;
+    atexit(save_errno);
+    for (size_t i = 0; i < sizeof(fatal) / sizeof(*fatal); i++)
+        sigaction(fatal[i], &sa, NULL);
+}
+
+// Limits above the hard limit would fail in the child, so refuse them here
+int check_limits(const t_sandbox_limits *limits)
+{
+    struct { int resource; rlim_t value; } want[] = {
+        {RLIMIT_AS, limits->as}, {RLIMIT_CPU, limits->cpu}, {RLIMIT_NOFILE, limits->nofile}};
+    for (size_t i = 0; i < sizeof(want) / sizeof(*want); i++)
+    {
+        struct rlimit rl;
+        if (!want[i].value) continue;
+        if (getrlimit(want[i].resource, &rl) == -1) return -1;
+        // RLIMIT_CPU keeps one more second of hard limit, see apply_limits()
+        rlim_t need = want[i].value + (want[i].resource == RLIMIT_CPU);
+        if (rl.rlim_max != RLIM_INFINITY && need > rl.rlim_max) { errno = EPERM; return -1; }
+    }
+    return 0;
+}
+
+void apply_limits(const t_sandbox_limits *limits)
+{
+    if (limits->as) setrlimit(RLIMIT_AS, &(struct rlimit){limits->as, limits->as});
+    if (limits->nofile) setrlimit(RLIMIT_NOFILE, &(struct rlimit){limits->nofile, limits->nofile});
+    // SIGXCPU at the soft limit is what identifies the CPU limit afterwards
+    if (limits->cpu) setrlimit(RLIMIT_CPU, &(struct rlimit){limits->cpu, limits->cpu + 1});
+}
+
+int limit_hit(const t_sandbox_limits *limits, t_sandbox_result *res, int last_errno)
+{
+    if (!limits || res->verdict != 0 || res->timed_out) return -1;
+    if (limits->cpu && WIFSIGNALED(res->status)
+        && (WTERMSIG(res->status) == SIGXCPU
+            || (WTERMSIG(res->status) == SIGKILL
+                && res->usage.ru_utime.tv_sec + res->usage.ru_stime.tv_sec >= (time_t)limits->cpu)))
+        return RLIMIT_CPU;
+    if (limits->as && last_errno == ENOMEM) return RLIMIT_AS;
+    if (limits->nofile && last_errno == EMFILE) return RLIMIT_NOFILE;
+    return -1;
+}
+
+long long now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * NS_PER_SEC + ts.tv_nsec;
+}
+
+void report(t_sandbox_job *job)
+{
+    t_sandbox_result *res = &job->result;
+    if (res->verdict == -1) return;
+    if (res->timed_out)
+    {
+        // whole seconds print as before, anything finer as a trimmed fraction
+        long long sec = job->timeout_ns / NS_PER_SEC, frac = job->timeout_ns % NS_PER_SEC;
+        int digits = 9;
+        for (; frac && frac % 10 == 0; frac /= 10) digits--;
+        if (frac) printf("Bad function: timed out after %lld.%0*lld seconds\n", sec, digits, frac);
+        else printf("Bad function: timed out after %lld seconds\n", sec);
+    }
+    else if (WIFSIGNALED(res->status))
+        printf("Bad function: %s\n", strsignal(WTERMSIG(res->status)));
+    else if (WEXITSTATUS(res->status))
+        printf("Bad function: exited with code %d\n", WEXITSTATUS(res->status));
+    else
+        printf("Nice function!\n");
+}
+
+void finish(t_sandbox_job *job, t_child *kid, bool timed_out)
+{
+    t_sandbox_result *res = &job->result;
+    // a child that exited just as its timer fired still made it in time
+    if (timed_out && wait4(kid->pid, &res->status, WNOHANG, &res->usage) == kid->pid)
+        timed_out = false;
+    else
+    {
+        if (timed_out) kill(kid->pid, SIGKILL);
+        while (wait4(kid->pid, &res->status, 0, &res->usage) == -1 && errno == EINTR);
+    }
+    res->wall_ns = now_ns() - kid->start_ns;
+    res->timed_out = timed_out;
+    res->verdict = !timed_out && WIFEXITED(res->status) && WEXITSTATUS(res->status) == 0;
+    res->limit_hit = limit_hit(job->limits, res, kid->last_errno ? *kid->last_errno : 0);
+    close(kid->pidfd);
+    if (kid->timerfd != -1) close(kid->timerfd);
+    kid->pid = 0;
+}
+
+int watch(int epfd, int fd, size_t i, int kind)
+{
+    struct epoll_event ev = {.events = EPOLLIN, .data.u64 = i << 1 | kind};
+    return epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev);
+}
+
+/*
+ * Without pidfd_open (before Linux 5.3, or filtered by seccomp) a child
+ * holds the write end of a pipe instead, whose EOF in the epoll set means
+ * it exited. Anything f leaves running with that end open delays it.
+ */
+int pidfd_works(void)
+{
+    static atomic_int works = -1;
+    if (works == -1)
+    {
+        int fd = syscall(SYS_pidfd_open, getpid(), 0);
+        if (fd != -1) close(fd);
+        works = fd != -1;
+    }
+    return works;
+}
+
+int exit_fd(pid_t pid, int pipefd[2])
+{
+    if (pipefd[0] == -1) return syscall(SYS_pidfd_open, pid, 0);
+    close(pipefd[1]);
+    return pipefd[0];
+}
+
+// Forks job's child and arms its pidfd and timer; -1 leaves nothing behind
+int start(t_sandbox_job *job, t_child *kid, size_t i, int epfd, int *last_errno)
+{
+    if (job->limits && check_limits(job->limits) == -1) return -1;
+    int pipefd[2] = {-1, -1};
+    if (!pidfd_works() && pipe2(pipefd, O_CLOEXEC) == -1) return -1;
+    long long start_ns = now_ns();
     pid_t pid = fork();
-    if (pid == -1) return -1;
+    if (pid == -1)
+    {
+        if (pipefd[0] != -1) { close(pipefd[0]); close(pipefd[1]); }
+        return -1;
+    }
     if (pid == 0)
     {
-        f();
+        if (pipefd[0] != -1) close(pipefd[0]);
+        if (job->limits)
+        {
+            track_errno(last_errno);
+            apply_limits(job->limits);
+        }
+        job->f();
         exit(0);
     }
-
-    struct sigaction sa_old, sa_new;
-    sigemptyset(&sa_new.sa_mask);
-    sa_new.sa_handler = SIG_IGN;
-    sa_new.sa_flags = 0;
-    if (sigaction(SIGALRM, &sa_new, &sa_old) == -1)
+    *kid = (t_child){.pid = pid, .pidfd = exit_fd(pid, pipefd), .timerfd = -1,
+        .start_ns = start_ns, .last_errno = job->limits ? last_errno : NULL};
+    struct itimerspec its = {.it_value = {job->timeout_ns / NS_PER_SEC, job->timeout_ns % NS_PER_SEC}};
+    if (kid->pidfd == -1 || watch(epfd, kid->pidfd, i, 0) == -1
+        || (job->timeout_ns > 0 && ((kid->timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC)) == -1
+            || timerfd_settime(kid->timerfd, 0, &its, NULL) == -1
+            || watch(epfd, kid->timerfd, i, 1) == -1)))
+    {
+        kill(pid, SIGKILL);
+        while (waitpid(pid, NULL, 0) == -1 && errno == EINTR);
+        if (kid->pidfd != -1) close(kid->pidfd);
+        if (kid->timerfd != -1) close(kid->timerfd);
+        kid->pid = 0;
         return -1;
-    alarm(timeout);
-    int status;
-    pid_t result = waitpid(pid, &status, 0);
-    alarm(0);
-    sigaction(SIGALRM, &sa_old, NULL);
+    }
+    return 0;
+}
 
-    if (result == -1)
+/*
+ * Runs every job's function at once, each in its own child with its own
+ * timeout, so the batch takes about as long as its slowest job. Timeouts
+ * come from a timerfd per child and exits from its pidfd, both in one
+ * epoll set: no alarm() or signal disposition is touched, so it is safe
+ * to call from several threads. Returns -1 if any job could not be run.
+ */
+int sandbox_batch(t_sandbox_job *jobs, size_t count, bool verbose)
+{
+    int epfd = epoll_create1(EPOLL_CLOEXEC);
+    t_child *kids = calloc(count ? count : 1, sizeof(t_child));
+    size_t errnos_len = (count ? count : 1) * sizeof(int);
+    int *errnos = mmap(NULL, errnos_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (epfd == -1 || !kids || errnos == MAP_FAILED)
     {
-        if (errno == EINTR)
+        if (epfd != -1) close(epfd);
+        if (errnos != MAP_FAILED) munmap(errnos, errnos_len);
+        free(kids);
+        return -1;
+    }
+    int ret = 0;
+    size_t running = 0;
+    // children exit() through our stdio buffers, which must not be replayed
+    fflush(NULL);
+    for (size_t i = 0; i < count; i++)
+    {
+        jobs[i].result = (t_sandbox_result){.verdict = -1, .limit_hit = -1};
+        if (start(&jobs[i], &kids[i], i, epfd, &errnos[i]) == -1) ret = -1;
+        else running++;
+    }
+    struct epoll_event events[64];
+    while (running)
+    {
+        int n = epoll_wait(epfd, events, 64, -1);
+        if (n == -1 && errno == EINTR) continue;
+        if (n == -1) { ret = -1; break; }
+        for (int e = 0; e < n; e++)
         {
-            kill(pid, SIGKILL);
-            waitpid(pid, NULL, 0);
-            if (verbose) printf("Bad function: timed out after %u seconds\n", timeout);
-            return 0;
+            size_t i = events[e].data.u64 >> 1;
+            if (!kids[i].pid) continue;
+            finish(&jobs[i], &kids[i], events[e].data.u64 & 1);
+            running--;
         }
-        return -1;
     }
+    // only reached with children left if epoll_wait failed
+    for (size_t i = 0; i < count; i++)
+        if (kids[i].pid) finish(&jobs[i], &kids[i], true);
+    close(epfd);
+    munmap(errnos, errnos_len);
+    free(kids);
+    for (size_t i = 0; verbose && i < count; i++)
+        report(&jobs[i]);
+    return ret;
+}
+
+// sandbox_ns() with resource limits applied to f's child
+int sandbox_limited(void (*f)(void), long long timeout_ns, const t_sandbox_limits *limits,
+    bool verbose, t_sandbox_result *res)
+{
+    t_sandbox_job job = {.f = f, .timeout_ns = timeout_ns, .limits = limits};
+    int ret = sandbox_batch(&job, 1, verbose);
+    if (res) *res = job.result;
+    return ret == -1 ? -1 : job.result.verdict;
+}
 
-    if (WIFEXITED(status))
+/*
+ * sandbox() with a nanosecond timeout on the monotonic clock. res, when
+ * not NULL, receives the verdict with the wall and CPU time f took.
+ */
+int sandbox_ns(void (*f)(void), long long timeout_ns, bool verbose, t_sandbox_result *res)
+{
+    return sandbox_limited(f, timeout_ns, NULL, verbose, res);
+}
+
+int sandbox(void (*f)(void), unsigned int timeout, bool verbose)
+{
+    return sandbox_ns(f, timeout * NS_PER_SEC, verbose, NULL);
+}
+
+/*
+ * Fork server: a process forked from the caller once, ideally early while
+ * the caller is still small, that runs sandbox_batch() on request so every
+ * check forks the server instead of the caller. Requests and results go
+ * over one socketpair; functions are sent as pointers, which stay valid
+ * because the server is a copy of the caller.
+ */
+typedef struct s_forkserver
+{
+    pid_t pid;
+    int fd;
+    pthread_mutex_t lock;
+} t_forkserver;
+
+typedef struct s_fs_request
+{
+    void (*f)(void);
+    long long timeout_ns;
+    bool limited;
+    t_sandbox_limits limits;
+} t_fs_request;
+
+int send_full(int fd, const void *buf, size_t len)
+{
+    for (const char *p = buf; len;)
     {
-        int exit_code = WEXITSTATUS(status);
-        if (exit_code == 0)
+        ssize_t n = send(fd, p, len, MSG_NOSIGNAL);
+        if (n == -1 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+int recv_full(int fd, void *buf, size_t len)
+{
+    for (char *p = buf; len;)
+    {
+        ssize_t n = recv(fd, p, len, 0);
+        if (n == -1 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+void forkserver_loop(int fd)
+{
+    size_t count;
+    while (recv_full(fd, &count, sizeof(count)) == 0)
+    {
+        t_sandbox_job *jobs = calloc(count ? count : 1, sizeof(t_sandbox_job));
+        t_fs_request *reqs = calloc(count ? count : 1, sizeof(t_fs_request));
+        if (!jobs || !reqs) _exit(1);
+        for (size_t i = 0; i < count; i++)
         {
-            if (verbose) printf("Nice function!\n");
-            return 1;
+            if (recv_full(fd, &reqs[i], sizeof(t_fs_request)) == -1) _exit(1);
+            jobs[i] = (t_sandbox_job){.f = reqs[i].f, .timeout_ns = reqs[i].timeout_ns,
+                .limits = reqs[i].limited ? &reqs[i].limits : NULL};
         }
-        if (verbose) printf("Bad function: exited with code %d\n", exit_code);
-        return 0;
+        int ret = sandbox_batch(jobs, count, false);
+        if (send_full(fd, &ret, sizeof(ret)) == -1) _exit(1);
+        for (size_t i = 0; i < count; i++)
+            if (send_full(fd, &jobs[i].result, sizeof(t_sandbox_result)) == -1) _exit(1);
+        free(jobs);
+        free(reqs);
     }
-    if (WIFSIGNALED(status))
+    _exit(0);
+}
+
+t_forkserver *forkserver_start(void)
+{
+    t_forkserver *fs = calloc(1, sizeof(t_forkserver));
+    int sv[2];
+    if (!fs || socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) == -1)
     {
-        int sig = WTERMSIG(status);
-        if (verbose) printf("Bad function: %s\n", strsignal(sig));
-        return 0;
+        free(fs);
+        return NULL;
     }
-    return 0;
-}
\ No newline at end of file
+    // the server's children exit() through copies of these buffers
+    fflush(NULL);
+    pid_t parent = getpid();
+    fs->pid = fork();
+    if (fs->pid == 0)
+    {
+        close(sv[0]);
+        prctl(PR_SET_PDEATHSIG, SIGKILL);
+        if (getppid() != parent) _exit(0);
+        forkserver_loop(sv[1]);
+    }
+    close(sv[1]);
+    if (fs->pid == -1)
+    {
+        close(sv[0]);
+        free(fs);
+        return NULL;
+    }
+    fs->fd = sv[0];
+    pthread_mutex_init(&fs->lock, NULL);
+    return fs;
+}
+
+void forkserver_stop(t_forkserver *fs)
+{
+    close(fs->fd);
+    while (waitpid(fs->pid, NULL, 0) == -1 && errno == EINTR);
+    pthread_mutex_destroy(&fs->lock);
+    free(fs);
+}
+
+// sandbox_batch() run by the fork server; callable from several threads
+int forkserver_run(t_forkserver *fs, t_sandbox_job *jobs, size_t count, bool verbose)
+{
+    int ret = 0;
+    pthread_mutex_lock(&fs->lock);
+    if (send_full(fs->fd, &count, sizeof(count)) == -1) ret = -2;
+    for (size_t i = 0; ret == 0 && i < count; i++)
+    {
+        t_fs_request req = {.f = jobs[i].f, .timeout_ns = jobs[i].timeout_ns, .limited = jobs[i].limits != NULL};
+        if (jobs[i].limits) req.limits = *jobs[i].limits;
+        if (send_full(fs->fd, &req, sizeof(req)) == -1) ret = -2;
+    }
+    if (ret == 0 && recv_full(fs->fd, &ret, sizeof(ret)) == -1) ret = -2;
+    for (size_t i = 0; ret != -2 && i < count; i++)
+        if (recv_full(fs->fd, &jobs[i].result, sizeof(t_sandbox_result)) == -1) ret = -2;
+    // a half-sent or half-read batch leaves the stream out of step for good
+    if (ret == -2) shutdown(fs->fd, SHUT_RDWR);
+    pthread_mutex_unlock(&fs->lock);
+    if (ret == -2)
+    {
+        // the server is gone or out of step: treat the batch as not run
+        for (size_t i = 0; i < count; i++)
+            jobs[i].result = (t_sandbox_result){.verdict = -1, .limit_hit = -1};
+        return -1;
+    }
+    for (size_t i = 0; verbose && i < count; i++)
+        report(&jobs[i]);
+    return ret;
+}
@@ -3,6 +3,14 @@
 #include <ctype.h>
 #include <string.h>
 #include <stdlib.h>
+#include <limits.h>
+#include <stdint.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <pthread.h>
+#include <stdatomic.h>
 
 typedef struct	json {
 	enum {
@@ -14,6 +22,7 @@ typedef struct	json {
 		struct {
 			struct pair	*data;
 			size_t		size;
+			struct s_keyindex	*index;	// see json_get()
 		} map;
 		int	integer;
 		char	*string;
@@ -28,188 +37,1663 @@ typedef struct	pair {
 void	free_json(json j);
 int	argo(json *dst, FILE *stream);
 
-int	peek(FILE *stream)
+/*
+ * Nodes of view documents, see argo_view(). They mirror json, but their
+ * strings and keys are slices: not NUL-terminated, read by length only.
+ */
+typedef struct s_slice
 {
-	int	c = getc(stream);
-	ungetc(c, stream);
-	return c;
+    const char *ptr;
+    size_t len;
+}   t_slice;
+
+typedef struct s_view
+{
+    int type;           // MAP, INTEGER or STRING, as in json
+    union {
+        struct {
+            struct s_view_pair *data;
+            size_t size;
+            struct s_keyindex *index;   // see view_get()
+        } map;
+        int integer;
+        t_slice string;
+    };
+}   t_view;
+
+typedef struct s_view_pair
+{
+    t_slice key;
+    t_view value;
+}   t_view_pair;
+
+// Maps nested deeper than this fail to parse instead of exhausting memory,
+// unless a parser is given another limit (argo_depth(), t_argo_push)
+#define ARGO_MAX_DEPTH (1 << 20)
+
+/*
+ * Maps with KEY_INDEX_MIN keys or more get a t_keyindex when they close.
+ * Its open-addressing table of positions in map.data, so map.data keeps
+ * insertion order, is built by the first lookup. The table comes from
+ * malloc and is published with a compare-and-swap, so lookups from
+ * several threads are safe and never allocate from a tree's arena.
+ * Malloc trees free the index with its map. Arena trees chain theirs in
+ * the arena, whose arena_free() and arena_reset() release the tables.
+ */
+#define KEY_INDEX_MIN 16
+
+typedef struct s_keytable
+{
+    size_t mask;
+    uint32_t slots[];   // pair position + 1, 0 when empty
+}   t_keytable;
+
+typedef struct s_keyindex
+{
+    _Atomic(t_keytable *) table;    // NULL until the first lookup
+    struct s_keyindex *next;        // the arena's other indexes
+}   t_keyindex;
+
+/*
+ * Arena parse mode: pair arrays, keys and strings are bumped out of
+ * chunks that double in size, so a whole tree is released in O(chunks).
+ */
+#define ARENA_CHUNK (1 << 16)
+#define ARENA_CHUNK_MAX (1 << 26)
+
+typedef struct s_chunk
+{
+    struct s_chunk *next;
+    size_t size;
+    size_t used;
+    char data[];
+}   t_chunk;
+
+typedef struct s_arena
+{
+    t_chunk *head;
+    t_keyindex *indexes;
+}   t_arena;
+
+void *arena_alloc(t_arena *a, size_t size)
+{
+    size = (size + 7) & ~(size_t)7;
+    t_chunk *c = a->head;
+    if (!c || c->size - c->used < size)
+    {
+        size_t cap = c && c->size < ARENA_CHUNK_MAX ? c->size << 1 : ARENA_CHUNK;
+        if (cap < size) cap = size;
+        c = (t_chunk *)malloc(sizeof(t_chunk) + cap);
+        if (!c) return NULL;
+        c->next = a->head;
+        c->size = cap;
+        c->used = 0;
+        a->head = c;
+    }
+    void *ptr = c->data + c->used;
+    c->used += size;
+    return ptr;
+}
+
+// Resizes in place while ptr is the newest allocation, copies otherwise
+void *arena_grow(t_arena *a, void *ptr, size_t old, size_t size)
+{
+    t_chunk *c = a->head;
+    size_t o = (old + 7) & ~(size_t)7, n = (size + 7) & ~(size_t)7;
+    if (ptr && c && (char *)ptr + o == c->data + c->used && c->used - o + n <= c->size)
+    {
+        c->used = c->used - o + n;
+        return ptr;
+    }
+    void *np = arena_alloc(a, size);
+    if (np && ptr) memcpy(np, ptr, old < size ? old : size);
+    return np;
+}
+
+void arena_free(t_arena *a)
+{
+    for (; a->indexes; a->indexes = a->indexes->next)
+        free(a->indexes->table);
+    while (a->head)
+    {
+        t_chunk *next = a->head->next;
+        free(a->head);
+        a->head = next;
+    }
+}
+
+// Empties the arena but keeps its newest, largest chunk for the next tree
+void arena_reset(t_arena *a)
+{
+    t_chunk *keep = a->head;
+    if (!keep)
+        return;
+    for (; a->indexes; a->indexes = a->indexes->next)
+        free(a->indexes->table);
+    a->head = keep->next;
+    arena_free(a);
+    keep->next = NULL;
+    keep->used = 0;
+    a->head = keep;
+}
+
+/*
+ * The parser walks its input in memory with a cursor. argo() maps the
+ * stream when it is a regular file and reads it through a window that
+ * refill() slides otherwise, see parser_open().
+ */
+#define READ_CHUNK (1 << 16)
+
+typedef struct s_parser
+{
+    const char *start;
+    const char *cur;
+    const char *end;
+    const char *error;  // where parsing failed, NULL until it does
+    bool too_deep;      // the failure is a '{' past max_depth
+    size_t max_depth;   // ARGO_MAX_DEPTH unless argo_depth() says otherwise
+    char *owned;        // heap copy of an unmappable stream, NDJSON only
+    void *map;
+    size_t map_len;
+    t_arena *arena;     // where nodes go, malloc when NULL
+    bool views;         // unescaped strings point into the input, see parse_view()
+    FILE *stream;       // refills window when streaming, see parser_stream()
+    char *window;
+    size_t window_len;
+    size_t offset;      // input bytes consumed before start
+}   t_parser;
+
+// Streamed input slides through the window; resident input never refills
+#define SAX_WINDOW (1 << 16)
+
+int refill(t_parser *p)
+{
+    if (!p->stream)
+        return 0;
+    p->offset += p->end - p->start;
+    size_t n = fread(p->window, 1, p->window_len, p->stream);
+    p->start = p->cur = p->window;
+    p->end = p->window + n;
+    return n > 0;
+}
+
+void *parser_alloc(t_parser *p, void *ptr, size_t old, size_t size)
+{
+    if (p->arena)
+        return arena_grow(p->arena, ptr, old, size);
+    return realloc(ptr, size);
+}
+
+void parser_free(t_parser *p, void *ptr)
+{
+    if (!p->arena)
+        free(ptr);
+}
+
+int	peek(t_parser *p)
+{
+	if (p->cur == p->end && !refill(p))
+		return EOF;
+	return (unsigned char)*p->cur;
+}
+
+// Only the first failure is kept; argo() reports it once parsing unwound
+int	unexpected(t_parser *p)
+{
+	if (!p->error)
+		p->error = p->cur;
+	return 0;
 }
 
-void	unexpected(FILE *stream)
+int	too_deep(t_parser *p)
 {
-	if (peek(stream) != EOF)
-		printf("Unexpected token '%c'\n", peek(stream));
+	if (!p->error)
+		p->too_deep = true;
+	return unexpected(p);
+}
+
+void	error_message(t_parser *p, char *buf, size_t size)
+{
+	if (!p->error)
+		snprintf(buf, size, "Out of memory");
+	else if (p->too_deep)
+		snprintf(buf, size, "Nesting deeper than %zu", p->max_depth);
+	else if (p->error < p->end)
+		snprintf(buf, size, "Unexpected token '%c'", *p->error);
 	else
-		printf("Unexpected end of input\n");
+		snprintf(buf, size, "Unexpected end of input");
 }
 
-int	accept(FILE *stream, char c)
+void	report_error(t_parser *p)
 {
-	if (peek(stream) == c)
+	char	msg[64];
+
+	error_message(p, msg, sizeof(msg));
+	printf("%s\n", msg);
+}
+
+int	accept(t_parser *p, char c)
+{
+	if (peek(p) == c)
 	{
-		(void)getc(stream);
+		p->cur++;
 		return 1;
 	}
 	return 0;
 }
 
-int	expect(FILE *stream, char c)
+int	expect(t_parser *p, char c)
 {
-	if (accept(stream, c))
+	if (accept(p, c))
 		return 1;
-	unexpected(stream);
-	return 0;
+	return unexpected(p);
+}
+
+/*
+ * Finds the next '"' or '\\' in [s, end). Clean runs between them are
+ * copied whole, 32 or 16 bytes are tested per step where the CPU allows.
+ */
+const char *scan_scalar(const char *s, const char *end)
+{
+    while (s < end && *s != '"' && *s != '\\')
+        s++;
+    return s;
+}
+
+#ifdef __SSE2__
+# include <immintrin.h>
+
+const char *scan_sse2(const char *s, const char *end)
+{
+    const __m128i quote = _mm_set1_epi8('"');
+    const __m128i slash = _mm_set1_epi8('\\');
+    for (; end - s >= 16; s += 16)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i *)s);
+        int mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, quote),
+                                                  _mm_cmpeq_epi8(v, slash)));
+        if (mask)
+            return s + __builtin_ctz(mask);
+    }
+    return scan_scalar(s, end);
+}
+
+__attribute__((target("avx2")))
+const char *scan_avx2(const char *s, const char *end)
+{
+    const __m256i quote = _mm256_set1_epi8('"');
+    const __m256i slash = _mm256_set1_epi8('\\');
+    for (; end - s >= 32; s += 32)
+    {
+        __m256i v = _mm256_loadu_si256((const __m256i *)s);
+        unsigned mask = _mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(v, quote),
+                                                             _mm256_cmpeq_epi8(v, slash)));
+        if (mask)
+            return s + __builtin_ctz(mask);
+    }
+    return scan_sse2(s, end);
+}
+
+const char *scan_string(const char *s, const char *end)
+{
+    if (__builtin_cpu_supports("avx2"))
+        return scan_avx2(s, end);
+    return scan_sse2(s, end);
+}
+#else
+const char *scan_string(const char *s, const char *end)
+{
+    return scan_scalar(s, end);
 }
+#endif
 
-int parse_string(FILE *stream, char **str)
+int parse_string(t_parser *p, char **str, size_t *len)
 {
-    if (!expect(stream, '"')) return 0;
-    size_t cap = 16, len = 0;
-    char *buf = (char *)malloc(cap);
+    if (!expect(p, '"')) return 0;
+    const char *run = p->cur;
+    p->cur = scan_string(p->cur, p->end);
+    if (p->views && !p->stream && p->cur < p->end && *p->cur == '"')
+    {
+        *str = (char *)run;
+        *len = p->cur++ - run;
+        return 1;
+    }
+    size_t cap = 16, size = 0;
+    char *buf = (char *)parser_alloc(p, NULL, 0, cap);
     if (!buf) return 0;
-    while (peek(stream) != '"' && peek(stream) != EOF)
+    for (;;)
     {
-        char c = getc(stream);
-        if (c == '\\')
+        size_t n = p->cur - run;
+        // room for the run, an escaped byte and the terminator
+        if (size + n + 2 > cap)
         {
-            c = getc(stream);
-            if (c == EOF) { free(buf); unexpected(stream); return 0; }
+            size_t old = cap;
+            while (size + n + 2 > cap) cap <<= 1;
+            char *nb = (char *)parser_alloc(p, buf, old, cap);
+            if (!nb) { parser_free(p, buf); return 0; }
+            buf = nb;
         }
-        if (len + 1 >= cap)
+        memcpy(buf + size, run, n);
+        size += n;
+        if (p->cur == p->end && refill(p))
         {
-            cap <<= 1;
-            char *nb = (char *)realloc(buf, cap);
-            if (!nb) { free(buf); return 0; }
-            buf = nb;
+            run = p->cur;
+            p->cur = scan_string(p->cur, p->end);
+            continue;
         }
-        buf[len++] = c;
+        if (p->cur == p->end || *p->cur == '"') break;
+        if (++p->cur == p->end && !refill(p)) { parser_free(p, buf); return unexpected(p); }
+        buf[size++] = *p->cur++;
+        run = p->cur;
+        p->cur = scan_string(p->cur, p->end);
     }
-    if (!expect(stream, '"')) { free(buf); return 0; }
-    buf[len] = '\0';
+    if (!expect(p, '"')) { parser_free(p, buf); return 0; }
+    buf[size] = '\0';
+    if (p->arena) // hand the unused tail back to the chunk
+        buf = (char *)arena_grow(p->arena, buf, cap, size + 1);
     *str = buf;
+    *len = size;
     return 1;
 }
 
-int parse_number(FILE *stream, int *num)
+// Same result as fscanf("%d"): saturate like strtol, then narrow to int
+int parse_number(t_parser *p, int *num)
 {
-    if (!isdigit(peek(stream))) return 0;
-    return fscanf(stream, "%d", num) == 1;
+    if (!isdigit(peek(p))) return 0;
+    long value = 0;
+    while (isdigit(peek(p)))
+    {
+        int digit = *p->cur++ - '0';
+        value = value > (LONG_MAX - digit) / 10 ? LONG_MAX : value * 10 + digit;
+    }
+    *num = (int)value;
+    return 1;
 }
 
-int parse_value(FILE *stream, json *dst);
+uint64_t hash_key(const char *key, size_t len)
+{
+    uint64_t h = 14695981039346656037ULL;
+    for (size_t i = 0; i < len; i++)
+        h = (h ^ (unsigned char)key[i]) * 1099511628211ULL;
+    return h;
+}
+
+// The i-th key of a pair array, json or view
+typedef t_slice (*t_key_fn)(const void *pairs, size_t i);
 
-int parse_map(FILE *stream, json *dst)
+t_slice json_key(const void *pairs, size_t i)
 {
-    if (!expect(stream, '{')) return 0;
+    const char *key = ((const pair *)pairs)[i].key;
+    return (t_slice){key, strlen(key)};
+}
 
-    dst->type = MAP;
-    dst->map.data = NULL;
-    dst->map.size = 0;
-    size_t cap = 0;
+t_slice view_key(const void *pairs, size_t i)
+{
+    return ((const t_view_pair *)pairs)[i].key;
+}
 
-    if (accept(stream, '}')) return 1;
+int key_equals(t_slice a, const char *key, size_t len)
+{
+    return a.len == len && !memcmp(a.ptr, key, len);
+}
 
-    do {
-        if (dst->map.size == cap)
+t_keyindex *new_index(t_arena *arena)
+{
+    t_keyindex *ix = (t_keyindex *)(arena ? arena_alloc(arena, sizeof(t_keyindex))
+        : malloc(sizeof(t_keyindex)));
+    if (!ix) return NULL;
+    atomic_init(&ix->table, NULL);
+    ix->next = NULL;
+    if (arena)
+    {
+        ix->next = arena->indexes;
+        arena->indexes = ix;
+    }
+    return ix;
+}
+
+void free_index(t_keyindex *ix)
+{
+    if (!ix) return;
+    free(ix->table);
+    free(ix);
+}
+
+// Duplicate keys resolve to their first occurrence, like a linear scan
+t_keytable *build_table(const void *pairs, size_t size, t_key_fn key_at)
+{
+    if (size >= UINT32_MAX) return NULL;
+    size_t cap = 1;
+    while (cap < size * 2) cap <<= 1;
+    t_keytable *ix = (t_keytable *)malloc(sizeof(t_keytable) + cap * sizeof(uint32_t));
+    if (!ix) return NULL;
+    ix->mask = cap - 1;
+    memset(ix->slots, 0, cap * sizeof(uint32_t));
+    for (size_t i = 0; i < size; i++)
+    {
+        t_slice key = key_at(pairs, i);
+        size_t h = hash_key(key.ptr, key.len) & ix->mask;
+        for (; ix->slots[h]; h = (h + 1) & ix->mask)
+            if (key_equals(key_at(pairs, ix->slots[h] - 1), key.ptr, key.len))
+                break;
+        if (!ix->slots[h])
+            ix->slots[h] = i + 1;
+    }
+    return ix;
+}
+
+// NULL when the map has no index or its table cannot be built: scan then
+const t_keytable *index_table(t_keyindex *ix, const void *pairs, size_t size, t_key_fn key_at)
+{
+    if (!ix) return NULL;
+    t_keytable *table = atomic_load_explicit(&ix->table, memory_order_acquire);
+    if (table) return table;
+    table = build_table(pairs, size, key_at);
+    if (!table) return NULL;
+    // a concurrent first lookup may have published its own table meanwhile
+    t_keytable *won = NULL;
+    if (atomic_compare_exchange_strong_explicit(&ix->table, &won, table,
+            memory_order_acq_rel, memory_order_acquire))
+        return table;
+    free(table);
+    return won;
+}
+
+// json keys are NUL-terminated, so len must cover a whole key to match
+json *json_get(const json *map, const char *key, size_t len)
+{
+    if (map->type != MAP) return NULL;
+    const t_keytable *ix = index_table(map->map.index, map->map.data, map->map.size, json_key);
+    if (!ix)
+    {
+        for (size_t i = 0; i < map->map.size; i++)
         {
-            cap = cap ? cap << 1 : 4;
-            pair *np = (pair *)realloc(dst->map.data, cap * sizeof(pair));
-            if (!np) return 0;
-            dst->map.data = np;
+            pair *e = &map->map.data[i];
+            if (strnlen(e->key, len + 1) == len && !memcmp(e->key, key, len))
+                return &e->value;
         }
-        char *key;
-        if (!parse_string(stream, &key)) return 0;
-        if (!expect(stream, ':')) { free(key); return 0; }
-        dst->map.data[dst->map.size].key = key;
-        if (!parse_value(stream, &dst->map.data[dst->map.size].value)) return 0;
-        dst->map.size++;
-    } while (accept(stream, ','));
+        return NULL;
+    }
+    for (size_t h = hash_key(key, len) & ix->mask; ix->slots[h]; h = (h + 1) & ix->mask)
+    {
+        pair *e = &map->map.data[ix->slots[h] - 1];
+        if (strnlen(e->key, len + 1) == len && !memcmp(e->key, key, len))
+            return &e->value;
+    }
+    return NULL;
+}
+
+/*
+ * Open maps live on an explicit stack rather than the C one. Its first
+ * frames are inline, so shallow documents never allocate for it.
+ */
+#define STACK_LOCAL 32
 
-    return expect(stream, '}');
+typedef struct s_frame
+{
+    union {
+        json *map;
+        t_view *view;   // in view documents
+    };
+    size_t n;           // pair capacity while parsing, next pair while writing
+}   t_frame;
+
+typedef struct s_stack
+{
+    t_frame *items;
+    size_t depth;
+    size_t cap;
+    t_frame local[STACK_LOCAL];
+}   t_stack;
+
+void stack_init(t_stack *s)
+{
+    s->items = s->local;
+    s->depth = 0;
+    s->cap = STACK_LOCAL;
 }
 
-int parse_value(FILE *stream, json *dst)
+t_frame *stack_push(t_stack *s, void *map)
 {
-    if (peek(stream) == '"')
+    if (s->depth == s->cap)
     {
-        dst->type = STRING;
-        return parse_string(stream, &dst->string);
+        t_frame *items = (t_frame *)malloc(s->cap * 2 * sizeof(t_frame));
+        if (!items) return NULL;
+        memcpy(items, s->items, s->depth * sizeof(t_frame));
+        if (s->items != s->local) free(s->items);
+        s->items = items;
+        s->cap *= 2;
     }
-    else if (isdigit(peek(stream)))
+    s->items[s->depth] = (t_frame){.map = map};
+    return &s->items[s->depth++];
+}
+
+void stack_free(t_stack *s)
+{
+    if (s->items != s->local)
+        free(s->items);
+}
+
+// A member counts as soon as its key is in, holding an INTEGER until its
+// value parses, so one free_json() of the root undoes a failed parse
+json *open_member(t_parser *p, t_frame *f)
+{
+    json *map = f->map;
+    if (map->map.size == f->n)
     {
-        dst->type = INTEGER;
-        return parse_number(stream, &dst->integer);
+        size_t cap = f->n ? f->n << 1 : 4;
+        pair *np = (pair *)parser_alloc(p, map->map.data, f->n * sizeof(pair), cap * sizeof(pair));
+        if (!np) return NULL;
+        map->map.data = np;
+        f->n = cap;
     }
-    else if (peek(stream) == '{')
+    pair *e = &map->map.data[map->map.size];
+    size_t len;
+    if (!parse_string(p, &e->key, &len)) return NULL;
+    e->value = (json){.type = INTEGER};
+    map->map.size++;
+    if (!expect(p, ':')) return NULL;
+    return &e->value;
+}
+
+void close_map(t_parser *p, json *map)
+{
+    if (map->map.size >= KEY_INDEX_MIN)
+        map->map.index = new_index(p->arena);
+}
+
+int parse_value(t_parser *p, json *dst)
+{
+    t_stack s;
+    stack_init(&s);
+    json *slot = dst;
+    *dst = (json){.type = INTEGER};
+    while (slot)
     {
-        return parse_map(stream, dst);
+        int c = peek(p);
+        if (c == '"')
+        {
+            size_t len;
+            if (!parse_string(p, &slot->string, &len)) break;
+            slot->type = STRING;
+        }
+        else if (isdigit(c))
+            parse_number(p, &slot->integer);
+        else if (c == '{')
+        {
+            if (s.depth == p->max_depth) { too_deep(p); break; }
+            p->cur++;
+            *slot = (json){.type = MAP};
+            if (!accept(p, '}'))
+            {
+                t_frame *f = stack_push(&s, slot);
+                if (!f) break;
+                slot = open_member(p, f);
+                continue;
+            }
+        }
+        else { unexpected(p); break; }
+        // climb out of every map this value completes
+        while (s.depth && !accept(p, ','))
+        {
+            if (!expect(p, '}')) break;
+            close_map(p, s.items[--s.depth].map);
+        }
+        if (p->error) break;
+        if (!s.depth)
+        {
+            stack_free(&s);
+            return 1;
+        }
+        slot = open_member(p, &s.items[s.depth - 1]);
     }
-    
-    unexpected(stream);
+    stack_free(&s);
+    if (!p->arena)
+        free_json(*dst);
     return 0;
 }
 
-int argo(json *dst, FILE *stream)
+// Maps a regular file from the stream's position; 0 leaves p untouched
+int parser_map(t_parser *p, FILE *stream)
+{
+    struct stat st;
+    long offset = ftell(stream);
+    if (offset < 0 || fstat(fileno(stream), &st) == -1 || !S_ISREG(st.st_mode)
+        || st.st_size <= offset)
+        return 0;
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fileno(stream), 0);
+    if (map == MAP_FAILED)
+        return 0;
+    p->map = map;
+    p->map_len = st.st_size;
+    p->start = p->cur = (const char *)map + offset;
+    p->end = (const char *)map + st.st_size;
+    return 1;
+}
+
+/*
+ * Anything else is read through the window. A seekable stream fills it
+ * SAX_WINDOW bytes at a time and parser_sync() seeks back over the rest.
+ * Pipes and sockets are read a byte at a time instead, so that a parse
+ * neither waits for input past its value nor swallows it.
+ */
+int parser_stream(t_parser *p, FILE *stream)
+{
+    p->stream = stream;
+    p->window_len = ftell(stream) >= 0 ? SAX_WINDOW : 1;
+    p->window = (char *)malloc(p->window_len);
+    p->start = p->cur = p->end = p->window;
+    return p->window ? 0 : -1;
+}
+
+int parser_open(t_parser *p, FILE *stream)
 {
-    if (parse_value(stream, dst))
+    *p = (t_parser){.max_depth = ARGO_MAX_DEPTH};
+    if (parser_map(p, stream))
+        return 0;
+    return parser_stream(p, stream);
+}
+
+// NDJSON needs all of its input resident, so what cannot be mapped is read
+int parser_load(t_parser *p, FILE *stream)
+{
+    *p = (t_parser){.max_depth = ARGO_MAX_DEPTH};
+    if (parser_map(p, stream))
+        return 0;
+    size_t len = 0, cap = 0, n;
+    do {
+        if (cap - len < READ_CHUNK)
+        {
+            cap = cap ? cap << 1 : READ_CHUNK;
+            char *nb = (char *)realloc(p->owned, cap);
+            if (!nb) { free(p->owned); return -1; }
+            p->owned = nb;
+        }
+        n = fread(p->owned + len, 1, cap - len, stream);
+        len += n;
+    } while (n > 0);
+    if (ferror(stream)) { free(p->owned); return -1; }
+    p->start = p->cur = p->owned;
+    p->end = p->owned + len;
+    return 0;
+}
+
+// Leaves the stream positioned just after the parsed value, as getc did
+void parser_sync(t_parser *p, FILE *stream)
+{
+    if (p->map)
+        fseek(stream, p->cur - (const char *)p->map, SEEK_SET);
+    else if (p->cur < p->end && p->window_len == 1)
+        ungetc((unsigned char)*p->cur, stream);
+    else if (p->cur < p->end)
+        fseek(stream, p->cur - p->end, SEEK_CUR);
+}
+
+void parser_close(t_parser *p)
+{
+    if (p->map)
+        munmap(p->map, p->map_len);
+    free(p->owned);
+    free(p->window);
+}
+
+int parse_document(t_parser *p, json *dst)
+{
+    if (parse_value(p, dst))
         return 1;
+    if (p->error)
+        report_error(p);
     return -1;
 }
 
+int argo_buffer(json *dst, const char *buf, size_t len)
+{
+    t_parser p = {.start = buf, .cur = buf, .end = buf + len, .max_depth = ARGO_MAX_DEPTH};
+    return parse_document(&p, dst);
+}
+
+// argo_arena() failing on maps nested deeper than max_depth
+int argo_depth(json *dst, FILE *stream, t_arena *arena, size_t max_depth)
+{
+    t_parser p;
+    if (parser_open(&p, stream) == -1)
+        return -1;
+    p.arena = arena;
+    p.max_depth = max_depth;
+    int ret = parse_document(&p, dst);
+    parser_sync(&p, stream);
+    parser_close(&p);
+    return ret;
+}
+
+// Builds the tree in arena; release it with arena_free(), not free_json()
+int argo_arena(json *dst, FILE *stream, t_arena *arena)
+{
+    return argo_depth(dst, stream, arena, ARGO_MAX_DEPTH);
+}
+
+int argo(json *dst, FILE *stream)
+{
+    return argo_arena(dst, stream, NULL);
+}
+
+/*
+ * View documents are built from t_view nodes, always in an arena. Mapped
+ * input stays mapped for as long as the document lives, and unescaped
+ * strings and keys are slices of it. Escaped ones, and all of those read
+ * from a stream, are copied into the arena.
+ */
+t_view *view_member(t_parser *p, t_frame *f)
+{
+    t_view *map = f->view;
+    if (map->map.size == f->n)
+    {
+        size_t cap = f->n ? f->n << 1 : 4;
+        t_view_pair *np = (t_view_pair *)arena_grow(p->arena, map->map.data,
+            f->n * sizeof(t_view_pair), cap * sizeof(t_view_pair));
+        if (!np) return NULL;
+        map->map.data = np;
+        f->n = cap;
+    }
+    t_view_pair *e = &map->map.data[map->map.size];
+    char *key;
+    if (!parse_string(p, &key, &e->key.len)) return NULL;
+    e->key.ptr = key;
+    e->value = (t_view){.type = INTEGER};
+    map->map.size++;
+    if (!expect(p, ':')) return NULL;
+    return &e->value;
+}
+
+void close_view(t_parser *p, t_view *map)
+{
+    if (map->map.size >= KEY_INDEX_MIN)
+        map->map.index = new_index(p->arena);
+}
+
+// parse_value() for view nodes; the arena is released whatever the outcome
+int parse_view(t_parser *p, t_view *dst)
+{
+    t_stack s;
+    stack_init(&s);
+    t_view *slot = dst;
+    *dst = (t_view){.type = INTEGER};
+    p->views = true;
+    while (slot)
+    {
+        int c = peek(p);
+        if (c == '"')
+        {
+            char *str;
+            if (!parse_string(p, &str, &slot->string.len)) break;
+            slot->string.ptr = str;
+            slot->type = STRING;
+        }
+        else if (isdigit(c))
+            parse_number(p, &slot->integer);
+        else if (c == '{')
+        {
+            if (s.depth == p->max_depth) { too_deep(p); break; }
+            p->cur++;
+            *slot = (t_view){.type = MAP};
+            if (!accept(p, '}'))
+            {
+                t_frame *f = stack_push(&s, slot);
+                if (!f) break;
+                slot = view_member(p, f);
+                continue;
+            }
+        }
+        else { unexpected(p); break; }
+        while (s.depth && !accept(p, ','))
+        {
+            if (!expect(p, '}')) break;
+            close_view(p, s.items[--s.depth].view);
+        }
+        if (p->error) break;
+        if (!s.depth)
+        {
+            stack_free(&s);
+            return 1;
+        }
+        slot = view_member(p, &s.items[s.depth - 1]);
+    }
+    stack_free(&s);
+    return 0;
+}
+
+t_view *view_get(const t_view *map, const char *key, size_t len)
+{
+    if (map->type != MAP) return NULL;
+    const t_keytable *ix = index_table(map->map.index, map->map.data, map->map.size, view_key);
+    if (!ix)
+    {
+        for (size_t i = 0; i < map->map.size; i++)
+            if (key_equals(map->map.data[i].key, key, len))
+                return &map->map.data[i].value;
+        return NULL;
+    }
+    for (size_t h = hash_key(key, len) & ix->mask; ix->slots[h]; h = (h + 1) & ix->mask)
+    {
+        t_view_pair *e = &map->map.data[ix->slots[h] - 1];
+        if (key_equals(e->key, key, len))
+            return &e->value;
+    }
+    return NULL;
+}
+
+typedef struct s_argo_doc
+{
+    t_view root;
+    t_arena arena;
+    t_parser input;
+}   t_argo_doc;
+
+void argo_doc_free(t_argo_doc *doc)
+{
+    parser_close(&doc->input);
+    arena_free(&doc->arena);
+    doc->input = (t_parser){0};
+}
+
+int argo_view(t_argo_doc *doc, FILE *stream)
+{
+    doc->arena = (t_arena){0};
+    if (parser_open(&doc->input, stream) == -1)
+        return -1;
+    doc->input.arena = &doc->arena;
+    int ret = parse_view(&doc->input, &doc->root) ? 1 : -1;
+    if (ret == -1 && doc->input.error)
+        report_error(&doc->input);
+    parser_sync(&doc->input, stream);
+    if (ret != 1)
+        argo_doc_free(doc);
+    return ret;
+}
+
+/*
+ * Event-driven parsing over the same grammar. Strings and keys arrive as
+ * chunks, the last one flagged, so memory stays at one window whatever
+ * the document size. Chunks are only valid during the callback. A NULL
+ * callback skips its event, and one returning 0 stops the parse.
+ */
+typedef struct s_argo_events
+{
+    int (*map_start)(void *ctx);
+    int (*key)(void *ctx, const char *chunk, size_t len, bool last);
+    int (*integer)(void *ctx, int value);
+    int (*string)(void *ctx, const char *chunk, size_t len, bool last);
+    int (*map_end)(void *ctx);
+}   t_argo_events;
+
+typedef int (*t_chunk_fn)(void *ctx, const char *chunk, size_t len, bool last);
+
+int emit(t_chunk_fn fn, void *ctx, const char *chunk, size_t len, bool last)
+{
+    return !fn || fn(ctx, chunk, len, last);
+}
+
+int sax_string(t_parser *p, t_chunk_fn fn, void *ctx)
+{
+    if (!expect(p, '"')) return 0;
+    for (;;)
+    {
+        if (p->cur == p->end && !refill(p)) return unexpected(p);
+        const char *run = p->cur;
+        p->cur = scan_string(p->cur, p->end);
+        if (p->cur < p->end && *p->cur == '"')
+            return emit(fn, ctx, run, p->cur++ - run, true);
+        if (run < p->cur && !emit(fn, ctx, run, p->cur - run, false)) return 0;
+        if (p->cur == p->end) continue;
+        // the escaped byte goes out as its own chunk
+        if (++p->cur == p->end && !refill(p)) return unexpected(p);
+        if (!emit(fn, ctx, p->cur++, 1, false)) return 0;
+    }
+}
+
+int sax_member(t_parser *p, const t_argo_events *ev, void *ctx)
+{
+    return sax_string(p, ev->key, ctx) && expect(p, ':');
+}
+
+// Every open frame is a map, so the depth alone stands in for the stack
+int sax_value(t_parser *p, const t_argo_events *ev, void *ctx)
+{
+    size_t depth = 0;
+    for (;;)
+    {
+        int c = peek(p);
+        if (c == '"')
+        {
+            if (!sax_string(p, ev->string, ctx)) return 0;
+        }
+        else if (isdigit(c))
+        {
+            int n;
+            if (!parse_number(p, &n)) return 0;
+            if (ev->integer && !ev->integer(ctx, n)) return 0;
+        }
+        else if (c == '{')
+        {
+            if (depth == p->max_depth) return too_deep(p);
+            p->cur++;
+            if (ev->map_start && !ev->map_start(ctx)) return 0;
+            if (!accept(p, '}'))
+            {
+                depth++;
+                if (!sax_member(p, ev, ctx)) return 0;
+                continue;
+            }
+            if (ev->map_end && !ev->map_end(ctx)) return 0;
+        }
+        else
+            return unexpected(p);
+        while (depth && !accept(p, ','))
+        {
+            if (!expect(p, '}')) return 0;
+            depth--;
+            if (ev->map_end && !ev->map_end(ctx)) return 0;
+        }
+        if (!depth) return 1;
+        if (!sax_member(p, ev, ctx)) return 0;
+    }
+}
+
+// 1 when the document was delivered, -1 on a syntax error or a stop
+int argo_sax(FILE *stream, const t_argo_events *ev, void *ctx)
+{
+    t_parser p = {.max_depth = ARGO_MAX_DEPTH};
+    if (parser_stream(&p, stream) == -1)
+        return -1;
+    int ret = 1;
+    if (!sax_value(&p, ev, ctx))
+    {
+        if (p.error)
+            report_error(&p);
+        ret = -1;
+    }
+    parser_sync(&p, stream);
+    parser_close(&p);
+    return ret;
+}
+
+/*
+ * Push parsing: the caller feeds chunks as they arrive and gets the same
+ * events as argo_sax(). Each open frame is a map waiting for ',' or '}',
+ * so the parse stack reduces to its depth and nothing is allocated.
+ */
+#define ARGO_NEED_MORE 0
+#define ARGO_DONE 1
+#define ARGO_ERROR -1
+
+enum e_push_state
+{
+    PUSH_VALUE,
+    PUSH_KEY_OR_END,    // just after '{'
+    PUSH_KEY,
+    PUSH_COLON,
+    PUSH_NEXT,          // ',' or '}' after a member
+    PUSH_STRING,
+    PUSH_ESCAPE,
+    PUSH_NUMBER,
+    PUSH_DONE,
+    PUSH_ERROR
+};
+
+typedef struct s_argo_push
+{
+    const t_argo_events *ev;
+    void *ctx;
+    enum e_push_state state;
+    bool in_key;        // the open string is a key
+    size_t depth;
+    long number;
+    size_t offset;      // bytes consumed over all chunks
+    size_t used;        // bytes of the last chunk consumed
+    int error;          // offending byte or EOF, 0 when a callback stopped
+    bool too_deep;
+    size_t max_depth;   // ARGO_MAX_DEPTH after argo_push_init(), set before feeding
+}   t_argo_push;
+
+void argo_push_init(t_argo_push *pp, const t_argo_events *ev, void *ctx)
+{
+    *pp = (t_argo_push){.ev = ev, .ctx = ctx, .state = PUSH_VALUE,
+        .max_depth = ARGO_MAX_DEPTH};
+}
+
+int push_result(t_argo_push *pp)
+{
+    if (pp->state == PUSH_DONE) return ARGO_DONE;
+    if (pp->state == PUSH_ERROR) return ARGO_ERROR;
+    return ARGO_NEED_MORE;
+}
+
+void push_fail(t_argo_push *pp, int c)
+{
+    pp->state = PUSH_ERROR;
+    pp->error = c;
+}
+
+void push_value_done(t_argo_push *pp)
+{
+    pp->state = pp->depth ? PUSH_NEXT : PUSH_DONE;
+}
+
+void push_number_done(t_argo_push *pp)
+{
+    if (pp->ev->integer && !pp->ev->integer(pp->ctx, (int)pp->number))
+        push_fail(pp, 0);
+    else
+        push_value_done(pp);
+}
+
+void push_map_end(t_argo_push *pp)
+{
+    pp->depth--;
+    if (pp->ev->map_end && !pp->ev->map_end(pp->ctx))
+        push_fail(pp, 0);
+    else
+        push_value_done(pp);
+}
+
+void push_chunk(t_argo_push *pp, const char *chunk, size_t len, bool last)
+{
+    if (!emit(pp->in_key ? pp->ev->key : pp->ev->string, pp->ctx, chunk, len, last))
+        push_fail(pp, 0);
+    else if (last)
+    {
+        if (pp->in_key)
+            pp->state = PUSH_COLON;
+        else
+            push_value_done(pp);
+    }
+}
+
+// Bytes after a complete value are left alone, pp->used says where it ended
+int argo_push(t_argo_push *pp, const char *chunk, size_t len)
+{
+    const char *s = chunk, *end = chunk + len;
+    while (s < end && pp->state < PUSH_DONE)
+    {
+        switch (pp->state)
+        {
+            case PUSH_STRING:
+            {
+                const char *run = s;
+                s = scan_string(s, end);
+                if (s < end && *s == '"')
+                    push_chunk(pp, run, s++ - run, true);
+                else
+                {
+                    if (run < s)
+                        push_chunk(pp, run, s - run, false);
+                    if (s < end && pp->state == PUSH_STRING)
+                    {
+                        s++;
+                        pp->state = PUSH_ESCAPE;
+                    }
+                }
+                break;
+            }
+            case PUSH_ESCAPE:
+                pp->state = PUSH_STRING;
+                push_chunk(pp, s++, 1, false);
+                break;
+            case PUSH_NUMBER:
+                if (!isdigit((unsigned char)*s))
+                    push_number_done(pp);
+                else
+                {
+                    int digit = *s++ - '0';
+                    pp->number = pp->number > (LONG_MAX - digit) / 10
+                        ? LONG_MAX : pp->number * 10 + digit;
+                }
+                break;
+            case PUSH_VALUE:
+                if (*s == '"')
+                {
+                    pp->in_key = false;
+                    pp->state = PUSH_STRING;
+                    s++;
+                }
+                else if (isdigit((unsigned char)*s))
+                {
+                    pp->number = 0;
+                    pp->state = PUSH_NUMBER;
+                }
+                else if (*s == '{')
+                {
+                    if (pp->depth == pp->max_depth)
+                    {
+                        pp->too_deep = true;
+                        push_fail(pp, '{');
+                        break;
+                    }
+                    s++;
+                    pp->depth++;
+                    pp->state = PUSH_KEY_OR_END;
+                    if (pp->ev->map_start && !pp->ev->map_start(pp->ctx))
+                        push_fail(pp, 0);
+                }
+                else
+                    push_fail(pp, (unsigned char)*s);
+                break;
+            case PUSH_KEY_OR_END:
+                if (*s == '}')
+                {
+                    s++;
+                    push_map_end(pp);
+                    break;
+                }
+                // fallthrough
+            case PUSH_KEY:
+                if (*s != '"')
+                {
+                    push_fail(pp, (unsigned char)*s);
+                    break;
+                }
+                s++;
+                pp->in_key = true;
+                pp->state = PUSH_STRING;
+                break;
+            case PUSH_COLON:
+                if (*s != ':')
+                    push_fail(pp, (unsigned char)*s);
+                else
+                {
+                    s++;
+                    pp->state = PUSH_VALUE;
+                }
+                break;
+            case PUSH_NEXT:
+                if (*s == ',')
+                    pp->state = PUSH_KEY;
+                else if (*s == '}')
+                    push_map_end(pp);
+                else
+                {
+                    push_fail(pp, (unsigned char)*s);
+                    break;
+                }
+                s++;
+                break;
+            default:
+                break;
+        }
+    }
+    pp->used = s - chunk;
+    pp->offset += pp->used;
+    return push_result(pp);
+}
+
+// Called once the input is over: completes a trailing number or fails
+int argo_push_end(t_argo_push *pp)
+{
+    if (pp->state == PUSH_NUMBER && !pp->depth)
+        push_number_done(pp);
+    if (pp->state < PUSH_DONE)
+        push_fail(pp, EOF);
+    return push_result(pp);
+}
+
+void argo_push_report(t_argo_push *pp)
+{
+    if (pp->too_deep)
+        printf("Nesting deeper than %zu\n", pp->max_depth);
+    else if (pp->error == EOF)
+        printf("Unexpected end of input\n");
+    else if (pp->error)
+        printf("Unexpected token '%c'\n", pp->error);
+}
+
+/*
+ * Frees without a stack: descending into a nested map parks the parent
+ * map in the pair that held it, whose key is already gone, and the parked
+ * pairs chain back up to the root.
+ */
 void	free_json(json j)
 {
-	switch (j.type)
+	pair	*parked = NULL;
+	size_t	i = 0;
+
+	if (j.type == STRING)
+		free(j.string);
+	if (j.type != MAP)
+		return ;
+	for (;;)
+	{
+		if (i < j.map.size)
+		{
+			pair	*e = &j.map.data[i++];
+			free(e->key);
+			if (e->value.type == STRING)
+				free(e->value.string);
+			if (e->value.type != MAP)
+				continue ;
+			json	child = e->value;
+			e->key = (char *)parked;
+			e->value.map.data = j.map.data;
+			e->value.map.size = j.map.size;
+			e->value.map.index = j.map.index;
+			parked = e;
+			j = child;
+			i = 0;
+			continue ;
+		}
+		free(j.map.data);
+		free_index(j.map.index);
+		if (!parked)
+			return ;
+		pair	*e = parked;
+		parked = (pair *)e->key;
+		j.map.data = e->value.map.data;
+		j.map.size = e->value.map.size;
+		i = e - j.map.data + 1;
+		j.map.index = e->value.map.index;
+	}
+}
+
+/*
+ * Output is gathered in a buffer. With a file descriptor it is flushed
+ * in large write()s, without one it grows to hold everything written.
+ */
+#define OUT_FLUSH (1 << 16)
+
+typedef struct s_out
+{
+    char *buf;
+    size_t len;
+    size_t cap;
+    int fd;             // -1 keeps everything in buf
+    bool failed;
+}   t_out;
+
+const char g_digit_pairs[] =
+    "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+    "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+    "8081828384858687888990919293949596979899";
+
+void out_write_fd(t_out *o, const char *s, size_t n)
+{
+    while (n && !o->failed)
+    {
+        ssize_t w = write(o->fd, s, n);
+        if (w < 0 && errno != EINTR)
+            o->failed = true;
+        else if (w > 0)
+        {
+            s += w;
+            n -= w;
+        }
+    }
+}
+
+void out_flush(t_out *o)
+{
+    if (o->fd >= 0)
+    {
+        out_write_fd(o, o->buf, o->len);
+        o->len = 0;
+    }
+}
+
+int out_room(t_out *o, size_t n)
+{
+    if (o->len + n <= o->cap)
+        return 1;
+    out_flush(o);
+    if (o->len + n <= o->cap)
+        return 1;
+    size_t cap = o->cap ? o->cap : OUT_FLUSH;
+    while (cap < o->len + n) cap <<= 1;
+    char *nb = (char *)realloc(o->buf, cap);
+    if (!nb)
+    {
+        o->failed = true;
+        return 0;
+    }
+    o->buf = nb;
+    o->cap = cap;
+    return 1;
+}
+
+void out_write(t_out *o, const char *s, size_t n)
+{
+    if (o->fd >= 0 && n >= OUT_FLUSH)
+    {
+        out_flush(o);
+        out_write_fd(o, s, n);
+    }
+    else if (out_room(o, n))
+    {
+        memcpy(o->buf + o->len, s, n);
+        o->len += n;
+    }
+}
+
+void out_char(t_out *o, char c)
+{
+    if (o->len < o->cap || out_room(o, 1))
+        o->buf[o->len++] = c;
+}
+
+void out_int(t_out *o, int value)
+{
+    char tmp[12], *p = tmp + sizeof(tmp);
+    unsigned v = value < 0 ? -(unsigned)value : (unsigned)value;
+    while (v >= 100)
+    {
+        p -= 2;
+        memcpy(p, g_digit_pairs + (v % 100) * 2, 2);
+        v /= 100;
+    }
+    if (v >= 10)
+    {
+        p -= 2;
+        memcpy(p, g_digit_pairs + v * 2, 2);
+    }
+    else
+        *--p = '0' + v;
+    if (value < 0)
+        *--p = '-';
+    out_write(o, p, tmp + sizeof(tmp) - p);
+}
+
+// Clean runs between quotes and backslashes are found like parse_string's
+void out_string(t_out *o, const char *s, size_t len)
+{
+    const char *end = s + len;
+    out_char(o, '"');
+    while (s < end)
+    {
+        const char *run = s;
+        s = scan_string(s, end);
+        out_write(o, run, s - run);
+        if (s < end)
+        {
+            out_char(o, '\\');
+            out_char(o, *s++);
+        }
+    }
+    out_char(o, '"');
+}
+
+void	serialize_to(t_out *o, json j)
+{
+	t_stack	s;
+	json	*v = &j;
+
+	stack_init(&s);
+	while (v && !o->failed)
 	{
-		case MAP:
-			for (size_t i = 0; i < j.map.size; i++)
+		switch (v->type)
+		{
+			case INTEGER:
+				out_int(o, v->integer);
+				break ;
+			case STRING:
+				out_string(o, v->string, strlen(v->string));
+				break ;
+			case MAP:
+				out_char(o, '{');
+				if (!stack_push(&s, v))
+					o->failed = true;
+				break ;
+		}
+		v = NULL;
+		while (s.depth && !v)
+		{
+			t_frame	*f = &s.items[s.depth - 1];
+			if (f->n < f->map->map.size)
+			{
+				pair	*e = &f->map->map.data[f->n];
+				if (f->n++ != 0)
+					out_char(o, ',');
+				out_string(o, e->key, strlen(e->key));
+				out_char(o, ':');
+				v = &e->value;
+			}
+			else
 			{
-				free(j.map.data[i].key);
-				free_json(j.map.data[i].value);
+				out_char(o, '}');
+				s.depth--;
 			}
-			free(j.map.data);
-			break ;
-		case STRING:
-			free(j.string);
-			break ;
-		default:
-			break ;
+		}
 	}
+	stack_free(&s);
 }
 
-void	serialize(json j)
+void	serialize_view_to(t_out *o, t_view root)
 {
-	switch (j.type)
+	t_stack	s;
+	t_view	*v = &root;
+
+	stack_init(&s);
+	while (v && !o->failed)
 	{
-		case INTEGER:
-			printf("%d", j.integer);
-			break ;
-		case STRING:
-			putchar('"');
-			for (int i = 0; j.string[i]; i++)
+		switch (v->type)
+		{
+			case INTEGER:
+				out_int(o, v->integer);
+				break ;
+			case STRING:
+				out_string(o, v->string.ptr, v->string.len);
+				break ;
+			case MAP:
+				out_char(o, '{');
+				if (!stack_push(&s, v))
+					o->failed = true;
+				break ;
+		}
+		v = NULL;
+		while (s.depth && !v)
+		{
+			t_frame	*f = &s.items[s.depth - 1];
+			if (f->n < f->view->map.size)
 			{
-				if (j.string[i] == '\\' || j.string[i] == '"')
-					putchar('\\');
-				putchar(j.string[i]);
+				t_view_pair	*e = &f->view->map.data[f->n];
+				if (f->n++ != 0)
+					out_char(o, ',');
+				out_string(o, e->key.ptr, e->key.len);
+				out_char(o, ':');
+				v = &e->value;
 			}
-			putchar('"');
-			break ;
-		case MAP:
-			putchar('{');
-			for (size_t i = 0; i < j.map.size; i++)
+			else
 			{
-				if (i != 0)
-					putchar(',');
-				serialize((json){.type = STRING, .string = j.map.data[i].key});
-				putchar(':');
-				serialize(j.map.data[i].value);
+				out_char(o, '}');
+				s.depth--;
 			}
-			putchar('}');
-			break ;
+		}
 	}
+	stack_free(&s);
+}
+
+// Writes straight to fd 1, after whatever stdout already buffered
+void	serialize(json j)
+{
+	t_out	o = {.fd = STDOUT_FILENO};
+
+	fflush(stdout);
+	serialize_to(&o, j);
+	out_flush(&o);
+	free(o.buf);
+}
+
+/*
+ * NDJSON mode, one value per line. The input is mapped once and cut into
+ * segments at line ends. Workers parse them as view documents in their
+ * own arenas, and each round of segments is written out in input order.
+ * Records are numbered from 0, counting blank lines, which are skipped.
+ */
+#define NDJSON_SEGMENT (1 << 20)
+#define NDJSON_ROUND 4          // segments per thread and round
+
+typedef struct s_segment
+{
+    const char *start;
+    const char *end;
+    size_t first;       // index of its first record
+    t_out out;
+    bool failed;
+}   t_segment;
+
+typedef struct s_ndjson
+{
+    const char *input;  // byte offsets are counted from here
+    t_segment *segs;
+    size_t count;
+    atomic_size_t next;
+}   t_ndjson;
+
+typedef struct s_nd_worker
+{
+    t_ndjson *nd;
+    t_arena arena;
+}   t_nd_worker;
+
+void ndjson_record(t_ndjson *nd, t_segment *seg, t_arena *arena,
+    const char *line, const char *end, size_t record)
+{
+    t_view root;
+    t_parser p = {.start = line, .cur = line, .end = end, .arena = arena,
+        .max_depth = ARGO_MAX_DEPTH};
+    int ok = parse_view(&p, &root);
+    if (ok && p.cur < p.end)
+        ok = unexpected(&p);
+    if (ok)
+    {
+        serialize_view_to(&seg->out, root);
+        out_char(&seg->out, '\n');
+    }
+    else
+    {
+        char msg[64], buf[128];
+        error_message(&p, msg, sizeof(msg));
+        int n = snprintf(buf, sizeof(buf), "record %zu, byte %zu: %s\n", record,
+            (size_t)((p.error ? p.error : p.cur) - nd->input), msg);
+        out_write(&seg->out, buf, n);
+        seg->failed = true;
+    }
+    arena_reset(arena);
+}
+
+void ndjson_segment(t_ndjson *nd, t_segment *seg, t_arena *arena)
+{
+    size_t record = seg->first;
+    seg->out = (t_out){.fd = -1};
+    for (const char *line = seg->start; line < seg->end; record++)
+    {
+        const char *nl = (const char *)memchr(line, '\n', seg->end - line);
+        const char *end = nl ? nl : seg->end;
+        if (end > line && end[-1] == '\r')
+            end--;
+        if (end > line)
+            ndjson_record(nd, seg, arena, line, end, record);
+        line = nl ? nl + 1 : seg->end;
+    }
+}
+
+void *ndjson_worker(void *arg)
+{
+    t_nd_worker *w = (t_nd_worker *)arg;
+    t_ndjson *nd = w->nd;
+    for (size_t i; (i = atomic_fetch_add(&nd->next, 1)) < nd->count;)
+        ndjson_segment(nd, &nd->segs[i], &w->arena);
+    return NULL;
+}
+
+// Cuts [start, end) after the first newline past every NDJSON_SEGMENT bytes
+t_segment *ndjson_split(const char *start, const char *end, size_t *count)
+{
+    size_t cap = (end - start) / NDJSON_SEGMENT + 1, n = 0, record = 0;
+    t_segment *segs = (t_segment *)calloc(cap, sizeof(t_segment));
+    if (!segs) return NULL;
+    for (const char *s = start; s < end; n++)
+    {
+        const char *stop = end;
+        if ((size_t)(end - s) > NDJSON_SEGMENT)
+        {
+            const char *nl = (const char *)memchr(s + NDJSON_SEGMENT, '\n', end - s - NDJSON_SEGMENT);
+            stop = nl ? nl + 1 : end;
+        }
+        segs[n] = (t_segment){.start = s, .end = stop, .first = record};
+        for (const char *nl = s; (nl = (const char *)memchr(nl, '\n', stop - nl)); nl++)
+            record++;
+        s = stop;
+    }
+    *count = n;
+    return segs;
+}
+
+// argo --ndjson [-j threads] file
+int ndjson(int ac, char **av)
+{
+    long threads = 1;
+    if (ac > 0 && !strcmp(av[0], "-j"))
+    {
+        threads = ac > 1 ? strtol(av[1], NULL, 10) : 0;
+        ac -= ac > 1 ? 2 : 1; av += 2;
+    }
+    if (threads < 1 || threads > 256 || ac != 1)
+    {
+        fprintf(stderr, "Usage: argo --ndjson [-j threads] file\n");
+        return 1;
+    }
+    FILE *stream = fopen(av[0], "r");
+    if (!stream)
+        return 1;
+    t_parser input;
+    int ret = parser_load(&input, stream);
+    fclose(stream);
+    if (ret == -1)
+        return 1;
+
+    t_ndjson nd = {.input = input.start};
+    size_t total = 0;
+    t_segment *segs = ndjson_split(input.start, input.end, &total);
+    t_nd_worker *workers = (t_nd_worker *)calloc(threads, sizeof(t_nd_worker));
+    pthread_t *tids = (pthread_t *)calloc(threads, sizeof(pthread_t));
+    t_out out = {.fd = STDOUT_FILENO};
+    bool failed = !segs || !workers || !tids, bad = false;
+    for (long t = 0; !failed && t < threads; t++)
+        workers[t].nd = &nd;
+
+    size_t round = threads * NDJSON_ROUND;
+    for (size_t base = 0; !failed && base < total; base += round)
+    {
+        nd.segs = segs + base;
+        nd.count = total - base < round ? total - base : round;
+        atomic_store(&nd.next, 0);
+        long spawned = 0;
+        for (; spawned + 1 < threads && (size_t)spawned + 1 < nd.count; spawned++)
+            if (pthread_create(&tids[spawned], NULL, ndjson_worker, &workers[spawned + 1]))
+                break;
+        ndjson_worker(&workers[0]);
+        for (long t = 0; t < spawned; t++)
+            pthread_join(tids[t], NULL);
+        for (size_t i = 0; i < nd.count; i++)
+        {
+            t_segment *seg = &nd.segs[i];
+            if (seg->out.len)
+                out_write(&out, seg->out.buf, seg->out.len);
+            bad |= seg->failed;
+            failed |= seg->out.failed;
+            free(seg->out.buf);
+        }
+    }
+    out_flush(&out);
+    free(out.buf);
+    for (long t = 0; workers && t < threads; t++)
+        arena_free(&workers[t].arena);
+    free(workers); free(tids); free(segs);
+    parser_close(&input);
+    return failed || bad || out.failed;
 }
 
 int	main(int argc, char **argv)
 {
+	if (argc > 1 && !strcmp(argv[1], "--ndjson"))
+		return ndjson(argc - 2, argv + 2);
 	if (argc != 2)
 		return 1;
 	char *filename = argv[1];